@@ -0,0 +1,29 @@
+/**
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 43):
+ *
+ * GitHub Co-pilot and <jens@bennerhq.com> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ *
+ * /benner
+ * ----------------------------------------------------------------------------
+ */
+
+/**
+ * aho.h -- header file for aho.c
+ */
+#ifndef __AHO_H__
+#define __AHO_H__
+
+#include <stdbool.h>
+
+typedef struct Aho Aho;
+
+Aho *aho_compile(const char *const *patterns, int count);
+bool aho_search(const Aho *aho, const char *str);
+int aho_count(const Aho *aho);
+void aho_free(Aho *aho);
+
+#endif /* __AHO_H__ */
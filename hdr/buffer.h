@@ -0,0 +1,33 @@
+/**
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 43):
+ *
+ * GitHub Co-pilot and <jens@bennerhq.com> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ *
+ * /benner
+ * ----------------------------------------------------------------------------
+ */
+
+/**
+ * buffer.h -- header file for buffer.c
+ */
+#ifndef __BUFFER_H__
+#define __BUFFER_H__
+
+#include <stddef.h>
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t size;
+} Buffer;
+
+void buffer_reserve(Buffer *buffer, size_t size);
+void buffer_append(Buffer *buffer, const char *str, size_t len);
+void buffer_printf(Buffer *buffer, const char *format, ...);
+void buffer_free(Buffer *buffer);
+
+#endif /* __BUFFER_H__ */
@@ -0,0 +1,31 @@
+/**
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 43):
+ *
+ * GitHub Co-pilot and <jens@bennerhq.com> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ *
+ * /benner
+ * ----------------------------------------------------------------------------
+ */
+
+/**
+ * datetime.h -- header file for datetime.c
+ */
+#ifndef __DATETIME_H__
+#define __DATETIME_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// YYYY-MM-DDTHH:MM:SS, plus the NUL when formatted
+#define DATETIME_LEN    (19)
+#define DATETIME_SIZE   (DATETIME_LEN + 1)
+
+bool datetime_parse(const char *str, size_t len, int64_t *value);
+void datetime_format(int64_t value, char *buffer);
+
+#endif /* __DATETIME_H__ */
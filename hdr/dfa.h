@@ -0,0 +1,32 @@
+/**
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 43):
+ *
+ * GitHub Co-pilot and <jens@bennerhq.com> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ *
+ * /benner
+ * ----------------------------------------------------------------------------
+ */
+
+/**
+ * dfa.h -- header file for dfa.c
+ */
+#ifndef __DFA_H__
+#define __DFA_H__
+
+#include <stdbool.h>
+
+#define DFA_MAX_POSITIONS   (256)   // Pattern characters and classes, the start included
+#define DFA_MAX_STATES      (512)   // Cached states, then the NFA is run directly
+#define DFA_MAX_REPEAT      (255)
+
+typedef struct Dfa Dfa;
+
+Dfa *dfa_compile(const char *pattern);
+bool dfa_match(Dfa *dfa, const char *str);
+void dfa_free(Dfa *dfa);
+
+#endif /* __DFA_H__ */
@@ -17,20 +17,28 @@
 #ifndef __EXEC_H__
 #define __EXEC_H__
 
-#include <time.h>
+#include <stdio.h>
+#include <stdint.h>
 #include <stdbool.h>
 
-#define DATE_FORMAT "%Y-%m-%dT%H:%M:%S"
+#include "arena.h"
 
 #define OP_NOP          (0)
 #define OP_PUSH_NUM     (1)
-#define OP_PUSH_VAR     (2)
-#define OP_PUSH_STR     (3)
-#define OP_JP           (4)
-#define OP_JPZ          (5)
-#define OP_HALT         (6)
+#define OP_PUSH_STR     (2)
+#define OP_PUSH_DT      (3)
+#define OP_LOAD_NUM     (4)
+#define OP_LOAD_STR     (5)
+#define OP_LOAD_DT      (6)
+#define OP_JP           (7)
+#define OP_JPZ          (8)
+#define OP_HALT         (9)
+#define OP_JPZ_AND      (10)    // Jump with 0 when false, else pop, for &
+#define OP_JPNZ_OR      (11)    // Jump with 1 when true, else pop, for |
+#define OP_BOOL         (12)
 
-#define OP_BASE         (OP_HALT + 1)
+// The untyped operators are only tokens, the code holds the typed ones
+#define OP_BASE         (OP_BOOL + 1)
 #   define OP_ADD          (OP_BASE + 0)
 #   define OP_SUB          (OP_BASE + 1)
 #   define OP_MUL          (OP_BASE + 2)
@@ -59,8 +67,9 @@
 #   define OP_AND_NUM      (OP_BASE_NUM + 10)
 #   define OP_OR_NUM       (OP_BASE_NUM + 11)
 #   define OP_NOT_NUM      (OP_BASE_NUM + 12)
+#   define OP_IN_SET_NUM   (OP_BASE_NUM + 13)    // Set in constant arg
 
-#define OP_BASE_STR     (OP_NOT_NUM + 1)
+#define OP_BASE_STR     (OP_IN_SET_NUM + 1)
 #   define OP_ADD_STR      (OP_BASE_STR + 0)
 #   define OP_SUB_STR      (OP_BASE_STR + 1)
 #   define OP_MUL_STR      (OP_BASE_STR + 2)
@@ -78,6 +87,58 @@
 #   define OP_IN_REGEX_STR (OP_BASE_STR + 14)
 #   define OP_UPPER_STR    (OP_BASE_STR + 15)
 #   define OP_LOWER_STR    (OP_BASE_STR + 16)
+#   define OP_IN_REGEX_C_STR (OP_BASE_STR + 17)  // Pattern compiled in constant arg
+#   define OP_IN_SET_STR   (OP_BASE_STR + 18)    // Set in constant arg
+#   define OP_IN_ANY_STR   (OP_BASE_STR + 19)    // Any of the literals in constant arg
+
+#define OP_BASE_DT      (OP_IN_ANY_STR + 1)
+#   define OP_ADD_DT       (OP_BASE_DT + 0)
+#   define OP_SUB_DT       (OP_BASE_DT + 1)
+#   define OP_MUL_DT       (OP_BASE_DT + 2)
+#   define OP_DIV_DT       (OP_BASE_DT + 3)
+#   define OP_NEQ_DT       (OP_BASE_DT + 4)
+#   define OP_LE_DT        (OP_BASE_DT + 5)
+#   define OP_GE_DT        (OP_BASE_DT + 6)
+#   define OP_LT_DT        (OP_BASE_DT + 7)
+#   define OP_GT_DT        (OP_BASE_DT + 8)
+#   define OP_EQ_DT        (OP_BASE_DT + 9)
+#   define OP_AND_DT       (OP_BASE_DT + 10)
+#   define OP_OR_DT        (OP_BASE_DT + 11)
+#   define OP_NOT_DT       (OP_BASE_DT + 12)
+
+// Fused column to constant compares, in the order of NEQ..EQ above
+#define OP_BASE_VC_NUM  (OP_NOT_DT + 1)
+#   define OP_NEQ_VC_NUM   (OP_BASE_VC_NUM + 0)
+#   define OP_LE_VC_NUM    (OP_BASE_VC_NUM + 1)
+#   define OP_GE_VC_NUM    (OP_BASE_VC_NUM + 2)
+#   define OP_LT_VC_NUM    (OP_BASE_VC_NUM + 3)
+#   define OP_GT_VC_NUM    (OP_BASE_VC_NUM + 4)
+#   define OP_EQ_VC_NUM    (OP_BASE_VC_NUM + 5)
+
+#define OP_BASE_VC_STR  (OP_EQ_VC_NUM + 1)
+#   define OP_NEQ_VC_STR   (OP_BASE_VC_STR + 0)
+#   define OP_LE_VC_STR    (OP_BASE_VC_STR + 1)
+#   define OP_GE_VC_STR    (OP_BASE_VC_STR + 2)
+#   define OP_LT_VC_STR    (OP_BASE_VC_STR + 3)
+#   define OP_GT_VC_STR    (OP_BASE_VC_STR + 4)
+#   define OP_EQ_VC_STR    (OP_BASE_VC_STR + 5)
+
+#define OP_BASE_VC_DT   (OP_EQ_VC_STR + 1)
+#   define OP_NEQ_VC_DT    (OP_BASE_VC_DT + 0)
+#   define OP_LE_VC_DT     (OP_BASE_VC_DT + 1)
+#   define OP_GE_VC_DT     (OP_BASE_VC_DT + 2)
+#   define OP_LT_VC_DT     (OP_BASE_VC_DT + 3)
+#   define OP_GT_VC_DT     (OP_BASE_VC_DT + 4)
+#   define OP_EQ_VC_DT     (OP_BASE_VC_DT + 5)
+
+#define OP_COUNT        (OP_EQ_VC_DT + 1)
+
+// Fused instructions pack a variable and a constant index in arg
+#define INSTR_PAIR(var, constant)   ((var) | ((constant) << 16))
+#define INSTR_VAR(arg)              ((arg) & 0xFFFF)
+#define INSTR_CONSTANT(arg)         ((arg) >> 16)
+
+#define MAX_STACK_SIZE  (1024)
 
 #define VAR_BASE        (1000)
 #   define VAR_NUMBER      (VAR_BASE + 0)
@@ -86,6 +147,9 @@
 #   define VAR_IDX         (VAR_BASE + 3)
 #   define VAR_UNKNOWN     (VAR_BASE + 4)
 #   define VAR_END         (VAR_BASE + 5)
+#   define VAR_REGEX       (VAR_BASE + 6)
+#   define VAR_SET         (VAR_BASE + 7)
+#   define VAR_AHO         (VAR_BASE + 8)
 
 typedef int OpCode;
 typedef int DataType;
@@ -95,15 +159,37 @@ typedef struct {
     DataType type;
     const char *name;
     bool is_dynamic;
+    bool is_constant;       // Config variables, fixed for the whole run
     union {
         const char *str;
         double value;
-        struct tm datetime;
+        int64_t datetime;   // Seconds since 1970-01-01T00:00:00
+        const struct Match *match;
+        const struct Set *set;
+        const struct Aho *aho;
     };
 } Variable;
 
-void execute_print_code(const Variable *code, const Variable *variables);
-Variable execute_code_datatype(const Variable *code, const Variable *variables);
-double execute_code(const Variable *code, const Variable *variables);
+// One instruction is 8 bytes, arg is the constant, variable or jump target
+typedef struct {
+    OpCode op;
+    int32_t arg;
+} Instr;
+
+// A compiled expression, the instructions and their constants in one block
+typedef struct {
+    const Instr *code;
+    const Variable *constants;
+    int code_size;
+    int constant_count;
+    int max_stack;
+    int parsed_size;    // Instructions as parsed, before any optimization
+    DataType type;
+} Program;
+
+void execute_print_code(FILE *file, const Program *program, const Variable *variables);
+int execute_stack_effect(OpCode op);
+Variable execute_code_datatype(const Program *program, const Variable *variables, Arena *arena);
+double execute_code(const Program *program, const Variable *variables, Arena *arena);
 
 #endif /* __EXEC_H__ */
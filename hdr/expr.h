@@ -31,13 +31,24 @@
         <digit> ::= "0" | "1" | "2" | "3" | "4" | "5" | "6" | "7" | "8" | "9"
         <variable> ::= <letter> | <variable> <letter> | <variable> <digit>
         <letter> ::= 'a' | 'b' | 'c' | ... | 'z' | 'A' | 'B' | 'C' | ... | 'Z'
+
+    A quoted 'YYYY-MM-DDTHH:MM:SS' literal compared with, or subtracted from, a
+    datetime variable is a datetime. Subtracting two datetimes gives seconds.
+
+    The right side of "in" may also be a set, matched exactly, not searched:
+        <variable> "in" <list> | <variable> "in" "file" "(" <string> ")"
+    A list is a constant string, or config variable, holding only quoted
+    items separated by commas, as in "'CAPE HENRY', 'TRITON'". file() reads
+    the file once, while parsing, with one entry per line, trimmed. Empty
+    entries never match, and number variables are matched by value.
 */
 #ifndef __EXPR_H__
 #define __EXPR_H__
 
 #include "exec.h"
 
-const Variable *parse_expression(const char *iexpr, Variable *ivariables);
-void parse_cleaning(Variable const *code);
+const Program *parse_expression(const char *iexpr, Variable *ivariables);
+void parse_cleaning(const Program *program);
+void parse_used_variables(const Program *program, bool *used, int count);
 
 #endif /* __EXPR_H__ */
@@ -0,0 +1,42 @@
+/**
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 43):
+ *
+ * GitHub Co-pilot and <jens@bennerhq.com> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ *
+ * /benner
+ * ----------------------------------------------------------------------------
+ */
+
+/**
+ * gzip.h -- header file for gzip.c
+ */
+#ifndef __GZIP_H__
+#define __GZIP_H__
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "buffer.h"
+
+#define GZIP_MAGIC_0    (0x1f)
+#define GZIP_MAGIC_1    (0x8b)
+
+typedef struct GzipReader GzipReader;
+typedef struct GzipWriter GzipWriter;
+
+bool gzip_is_magic(const char *data, size_t len);
+GzipReader *gzip_reader_open(int fd, const char *prefix, size_t prefix_len);
+ssize_t gzip_reader_read(GzipReader *gzip, char *buf, size_t size);
+void gzip_reader_close(GzipReader *gzip);
+
+GzipWriter *gzip_writer_open(FILE *file, int threads);
+void gzip_writer_write(GzipWriter *gzip, Buffer *output);
+void gzip_writer_close(GzipWriter *gzip);
+
+#endif /* __GZIP_H__ */
@@ -0,0 +1,34 @@
+/**
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 43):
+ *
+ * GitHub Co-pilot and <jens@bennerhq.com> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ *
+ * /benner
+ * ----------------------------------------------------------------------------
+ */
+
+/**
+ * match.h -- header file for match.c
+ */
+#ifndef __MATCH_H__
+#define __MATCH_H__
+
+#include <stdbool.h>
+
+#define MATCH_CACHE_SIZE    (64)
+#define MATCH_ROW_LEN       (256)     // Longest uncached pattern kept on the stack
+
+typedef struct Match Match;
+
+Match *match_compile(const char *pattern);
+bool match_exec(const Match *match, const char *str);
+bool match_dynamic(const char *pattern, const char *str);
+const char *match_pattern(const Match *match);
+void match_free(Match *match);
+void match_cleaning();
+
+#endif /* __MATCH_H__ */
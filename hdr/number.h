@@ -0,0 +1,25 @@
+/**
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 43):
+ *
+ * GitHub Co-pilot and <jens@bennerhq.com> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ *
+ * /benner
+ * ----------------------------------------------------------------------------
+ */
+
+/**
+ * number.h -- header file for number.c
+ */
+#ifndef __NUMBER_H__
+#define __NUMBER_H__
+
+#include <stddef.h>
+
+size_t number_parse(const char *str, size_t len, double *value);
+size_t number_parse_int(const char *str, size_t len, double *value);
+
+#endif /* __NUMBER_H__ */
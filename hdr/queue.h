@@ -0,0 +1,39 @@
+/**
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 43):
+ *
+ * GitHub Co-pilot and <jens@bennerhq.com> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ *
+ * /benner
+ * ----------------------------------------------------------------------------
+ */
+
+/**
+ * queue.h -- header file for queue.c
+ */
+#ifndef __QUEUE_H__
+#define __QUEUE_H__
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define QUEUE_CACHE_LINE    (64)
+
+typedef struct {
+    void **items;
+    size_t mask;
+    atomic_size_t head;
+    char pad_head[QUEUE_CACHE_LINE - sizeof(atomic_size_t)];
+    atomic_size_t tail;
+    char pad_tail[QUEUE_CACHE_LINE - sizeof(atomic_size_t)];
+} Queue;
+
+void queue_init(Queue *queue, size_t capacity);
+void queue_push(Queue *queue, void *item);
+void *queue_pop(Queue *queue);
+void queue_free(Queue *queue);
+
+#endif /* __QUEUE_H__ */
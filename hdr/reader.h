@@ -0,0 +1,66 @@
+/**
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 43):
+ *
+ * GitHub Co-pilot and <jens@bennerhq.com> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ *
+ * /benner
+ * ----------------------------------------------------------------------------
+ */
+
+/**
+ * reader.h -- header file for reader.c
+ */
+#ifndef __READER_H__
+#define __READER_H__
+
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef struct {
+    const char *str;
+    size_t len;
+} Span;
+
+typedef struct ReadAhead ReadAhead;
+
+typedef struct {
+    int fd;
+    size_t size;
+
+    // Memory mapped input
+    const char *data;
+    size_t pos;
+    char *tail;
+
+    // Streamed input, for anything that can't be mapped
+    char *buffer;
+    size_t buffer_size;
+    size_t start;
+    size_t end;
+    size_t scan;
+    bool eof;
+
+    // Rows may hold quoted newlines (RFC 4180), and the quote state of the
+    // row being scanned in the stream buffer
+    bool quotes;
+    bool quoted;
+
+    // Reader thread, filling blocks ahead of the stream buffer
+    ReadAhead *ahead;
+} Reader;
+
+bool reader_open(Reader *reader, const char *filename, bool map, int read_ahead);
+bool reader_next_line(Reader *reader, Span *line);
+size_t reader_size(const Reader *reader);
+void reader_close(Reader *reader);
+
+bool reader_quote_parity(const char *pos, const char *end);
+const char *reader_row_end(const char *pos, const char *end, bool *quoted);
+
+Span span_trim(Span span);
+
+#endif /* __READER_H__ */
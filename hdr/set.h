@@ -0,0 +1,36 @@
+/**
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 43):
+ *
+ * GitHub Co-pilot and <jens@bennerhq.com> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ *
+ * /benner
+ * ----------------------------------------------------------------------------
+ */
+
+/**
+ * set.h -- header file for set.c
+ */
+#ifndef __SET_H__
+#define __SET_H__
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#define SET_MIN_SLOTS   (16)
+
+typedef struct Set Set;
+
+Set *set_create();
+void set_add(Set *set, const char *str, size_t len);
+bool set_contains(const Set *set, const char *str, size_t len);
+bool set_contains_number(const Set *set, double value);
+int set_count(const Set *set);
+Set *set_parse_list(const char *list);
+Set *set_load(const char *filename);
+void set_free(Set *set);
+
+#endif /* __SET_H__ */
@@ -0,0 +1,25 @@
+/**
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 43):
+ *
+ * GitHub Co-pilot and <jens@bennerhq.com> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ *
+ * /benner
+ * ----------------------------------------------------------------------------
+ */
+
+/**
+ * token.h -- header file for token.c
+ */
+#ifndef __TOKEN_H__
+#define __TOKEN_H__
+
+#include "reader.h"
+
+void token_init(void);
+int token_split(Span *tokens, int max_tokens, int limit, Span line, const char *delimiter, char *scratch);
+
+#endif /* __TOKEN_H__ */
@@ -0,0 +1,42 @@
+/**
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 43):
+ *
+ * GitHub Co-pilot and <jens@bennerhq.com> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ *
+ * /benner
+ * ----------------------------------------------------------------------------
+ */
+
+/**
+ * writer.h -- header file for writer.c
+ */
+#ifndef __WRITER_H__
+#define __WRITER_H__
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "buffer.h"
+#include "gzip.h"
+
+typedef struct WriteBehind WriteBehind;
+
+typedef struct {
+    FILE *file;
+
+    // Writer thread, flushing blocks behind the parser
+    WriteBehind *behind;
+
+    // Compression threads, writing gzip members in order
+    GzipWriter *gzip;
+} Writer;
+
+bool writer_open(Writer *writer, const char *filename, int write_behind, int gzip_threads);
+void writer_write(Writer *writer, Buffer *output);
+void writer_close(Writer *writer);
+
+#endif /* __WRITER_H__ */
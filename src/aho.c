@@ -0,0 +1,153 @@
+/**
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 43):
+ *
+ * GitHub Co-pilot and <jens@bennerhq.com> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ *
+ * /benner
+ * ----------------------------------------------------------------------------
+ */
+
+/**
+ * aho.c - Aho-Corasick automaton for many substrings of one string
+ *
+ * "'TANKER' in VesselName | 'LNG' in VesselName | ..." asks if any of the
+ * literals occurs in the column. The literals make one trie, and each state
+ * gets a transition for every byte class, so the failure links are followed
+ * while compiling and never while matching. A row is then one walk over the
+ * string, one table lookup per byte, however many literals there are.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "../hdr/dmalloc.h"
+#include "../hdr/aho.h"
+
+struct Aho {
+    int count;
+
+    // Bytes in no literal are class 0, it always leads back to the start
+    uint8_t classes[256];
+    int class_count;
+
+    int state_count;
+    int32_t *next;      // state * class_count + class
+    bool *matched;      // A literal ends in the state, or in one of its suffixes
+};
+
+void *aho_alloc(size_t size) {
+    void *ptr = mem_malloc(size);
+    if (ptr == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+/**
+ * The automaton for the non-empty patterns, empty ones never match like
+ * with 'in'.
+ */
+Aho *aho_compile(const char *const *patterns, int count) {
+    Aho *aho = (Aho *) aho_alloc(sizeof(Aho));
+    aho->count = count;
+
+    int max_states = 1;
+    aho->class_count = 1;
+    for (int index = 0; index < count; index++) {
+        for (const unsigned char *pos = (const unsigned char *) patterns[index]; *pos; pos++) {
+            if (aho->classes[*pos] == 0) {
+                aho->classes[*pos] = (uint8_t) aho->class_count++;
+            }
+            max_states++;
+        }
+    }
+
+    // The trie, 0 is the start state and also "no edge yet"
+    int classes = aho->class_count;
+    aho->next = (int32_t *) aho_alloc((size_t) max_states * classes * sizeof(int32_t));
+    aho->matched = (bool *) aho_alloc(max_states * sizeof(bool));
+    aho->state_count = 1;
+    for (int index = 0; index < count; index++) {
+        if (*patterns[index] == '\0') {
+            continue;
+        }
+
+        int32_t state = 0;
+        for (const unsigned char *pos = (const unsigned char *) patterns[index]; *pos; pos++) {
+            int32_t *edge = &aho->next[state * classes + aho->classes[*pos]];
+            if (*edge == 0) {
+                *edge = aho->state_count++;
+            }
+            state = *edge;
+        }
+        aho->matched[state] = true;
+    }
+
+    // Breadth first, a state's failure is done before its children need it
+    int32_t *fail = (int32_t *) aho_alloc(aho->state_count * sizeof(int32_t));
+    int32_t *queue = (int32_t *) aho_alloc(aho->state_count * sizeof(int32_t));
+    int head = 0;
+    int tail = 0;
+    for (int class = 0; class < classes; class++) {
+        if (aho->next[class] != 0) {
+            queue[tail++] = aho->next[class];
+        }
+    }
+
+    while (head < tail) {
+        int32_t state = queue[head++];
+        int32_t *row = &aho->next[state * classes];
+        const int32_t *fail_row = &aho->next[fail[state] * classes];
+        for (int class = 0; class < classes; class++) {
+            if (row[class] == 0) {
+                row[class] = fail_row[class];
+                continue;
+            }
+
+            int32_t child = row[class];
+            fail[child] = fail_row[class];
+            aho->matched[child] |= aho->matched[fail[child]];
+            queue[tail++] = child;
+        }
+    }
+
+    mem_free(queue);
+    mem_free(fail);
+    return aho;
+}
+
+bool aho_search(const Aho *aho, const char *str) {
+    const int32_t *next = aho->next;
+    const bool *matched = aho->matched;
+    int classes = aho->class_count;
+
+    int32_t state = 0;
+    for (const unsigned char *pos = (const unsigned char *) str; *pos; pos++) {
+        state = next[state * classes + aho->classes[*pos]];
+        if (matched[state]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int aho_count(const Aho *aho) {
+    return aho->count;
+}
+
+void aho_free(Aho *aho) {
+    if (aho == NULL) {
+        return;
+    }
+
+    mem_free(aho->next);
+    mem_free(aho->matched);
+    mem_free(aho);
+}
@@ -0,0 +1,103 @@
+/**
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 43):
+ *
+ * GitHub Co-pilot and <jens@bennerhq.com> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ *
+ * /benner
+ * ----------------------------------------------------------------------------
+ */
+
+/**
+ * arena.c - Bump allocator for the strings a row's scripts make
+ *
+ * Allocating moves a pointer, and a reset takes back everything at once, so
+ * the VM never frees a string. The blocks are kept between rows, and once
+ * the first rows have made them big enough a row allocates nothing.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../hdr/dmalloc.h"
+#include "../hdr/arena.h"
+
+#define ARENA_MIN_SIZE      (1024 * 4)
+
+struct ArenaBlock {
+    ArenaBlock *next;
+    size_t size;
+    size_t used;
+    char data[];
+};
+
+/**
+ * Moves on to a block with room for size bytes, the ones after current are
+ * unused since the reset. A new one goes last, at least twice the size of
+ * the one before.
+ */
+char *arena_alloc_block(Arena *arena, size_t size) {
+    ArenaBlock *block = arena->current;
+    while (block != NULL && block->next != NULL) {
+        block = block->next;
+        block->used = 0;
+        if (block->size >= size) {
+            arena->current = block;
+            block->used = size;
+            return block->data;
+        }
+    }
+
+    size_t block_size = block != NULL ? 2 * block->size : ARENA_MIN_SIZE;
+    while (block_size < size) {
+        block_size *= 2;
+    }
+
+    ArenaBlock *added = (ArenaBlock *) mem_malloc(sizeof(ArenaBlock) + block_size);
+    if (added == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    *added = (ArenaBlock) { .next = NULL, .size = block_size, .used = size };
+
+    if (block != NULL) {
+        block->next = added;
+    }
+    else {
+        arena->first = added;
+    }
+    arena->current = added;
+    return added->data;
+}
+
+char *arena_alloc(Arena *arena, size_t size) {
+    ArenaBlock *block = arena->current;
+    if (block != NULL && block->size - block->used >= size) {
+        char *ptr = block->data + block->used;
+        block->used += size;
+        return ptr;
+    }
+    return arena_alloc_block(arena, size);
+}
+
+void arena_reset(Arena *arena) {
+    arena->current = arena->first;
+    if (arena->first != NULL) {
+        arena->first->used = 0;
+    }
+}
+
+void arena_free(Arena *arena) {
+    ArenaBlock *block = arena->first;
+    while (block != NULL) {
+        ArenaBlock *next = block->next;
+        mem_free(block);
+        block = next;
+    }
+
+    arena->first = NULL;
+    arena->current = NULL;
+}
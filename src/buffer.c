@@ -0,0 +1,91 @@
+/**
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 43):
+ *
+ * GitHub Co-pilot and <jens@bennerhq.com> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ *
+ * /benner
+ * ----------------------------------------------------------------------------
+ */
+
+/**
+ * buffer.c - Growable byte buffer, reused between rows
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "../hdr/dmalloc.h"
+#include "../hdr/buffer.h"
+
+#define BUFFER_MIN_SIZE     (1024 * 4)
+
+/**
+ * Makes room for at least size bytes. The buffer only ever grows, so rows of
+ * normal length never pay for an allocation once the first one is made.
+ */
+void buffer_reserve(Buffer *buffer, size_t size) {
+    if (size <= buffer->size) {
+        return;
+    }
+
+    size_t new_size = buffer->size ? buffer->size : BUFFER_MIN_SIZE;
+    while (new_size < size) {
+        new_size *= 2;
+    }
+
+    char *data = (char *) mem_realloc(buffer->data, new_size, buffer->size);
+    if (data == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    buffer->data = data;
+    buffer->size = new_size;
+}
+
+void buffer_append(Buffer *buffer, const char *str, size_t len) {
+    buffer_reserve(buffer, buffer->len + len + 1);
+
+    memcpy(buffer->data + buffer->len, str, len);
+    buffer->len += len;
+    buffer->data[buffer->len] = '\0';
+}
+
+void buffer_printf(Buffer *buffer, const char *format, ...) {
+    va_list args;
+
+    buffer_reserve(buffer, buffer->len + 64);
+
+    va_start(args, format);
+    size_t left = buffer->size - buffer->len;
+    int len = vsnprintf(buffer->data + buffer->len, left, format, args);
+    va_end(args);
+
+    if (len < 0) {
+        fprintf(stderr, "Error: Can't format output\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if ((size_t) len >= left) {
+        buffer_reserve(buffer, buffer->len + len + 1);
+
+        va_start(args, format);
+        vsnprintf(buffer->data + buffer->len, len + 1, format, args);
+        va_end(args);
+    }
+
+    buffer->len += len;
+}
+
+void buffer_free(Buffer *buffer) {
+    mem_free(buffer->data);
+
+    buffer->data = NULL;
+    buffer->len = 0;
+    buffer->size = 0;
+}
@@ -17,8 +17,8 @@
 
 #include "../hdr/dmalloc.h"
 #include "../hdr/conf.h"
-
-#define MAX_LINE_LENGTH     1024
+#include "../hdr/reader.h"
+#include "../hdr/buffer.h"
 
 char *trim_whitespace(char *str) {
     char *end;
@@ -57,80 +57,59 @@ void conf_add_key_value(Config *config, const char *key, const char *value) {
 }
 
 void conf_add_key_str(Config *config, const char *key, const char *value) {
-    if (strlen(value) + 3 >= MAX_LINE_LENGTH) {
-        fprintf(stderr, "Value too long\n");
+    size_t len = strlen(value);
+    char *value_str = mem_malloc(len + 3);
+    if (!value_str) {
+        perror("Out of memory");
         exit(EXIT_FAILURE);
     }
 
-    char value_str[MAX_LINE_LENGTH];
-    sprintf(value_str, "'%s'", value);
+    value_str[0] = '\'';
+    memcpy(value_str + 1, value, len);
+    value_str[len + 1] = '\'';
+    value_str[len + 2] = '\0';
+
     conf_add_key_value(config, key, value_str);
+    mem_free(value_str);
 }
 
 void conf_read_file(Config *config, const char *filename) {
-    FILE *file = fopen(filename, "r");
-    if (!file) {
+    Reader reader;
+    if (!reader_open(&reader, filename, true, 0)) {
         fprintf(stderr, "Can't open file %s\n", filename);
         exit(EXIT_FAILURE);
     }
 
-    char line_read[MAX_LINE_LENGTH];
-    char *current_line = NULL;
-    size_t current_line_size = 0;
+    Buffer current_line = { .data = NULL, .len = 0, .size = 0 };
+    Span line_read;
 
-    while (fgets(line_read, sizeof(line_read), file) != NULL) {
-        if (strlen(line_read) == sizeof(line_read) - 1) {
-            fprintf(stderr, "Error: Line too long\n");
-            exit(EXIT_FAILURE);
-        }
-        char *line = trim_whitespace(line_read);
-        if (*line == '\0' || *line == '#') {
+    while (reader_next_line(&reader, &line_read)) {
+        Span line = span_trim(line_read);
+        if (line.len == 0 || *line.str == '#') {
             continue;
         }
 
-        size_t line_len = strlen(line);
-        char *new_line = mem_realloc(current_line, current_line_size + line_len + 1, current_line_size);
-        if (!new_line) {
-            perror("Out of memory");
-            exit(EXIT_FAILURE);
-        }
-        current_line = new_line;
-        strcat(current_line, line);
-        current_line_size += line_len + 1;
+        buffer_append(&current_line, line.str, line.len);
 
-        size_t current_len = strlen(current_line);
-        if (current_len > 1 && current_line[current_len - 1] == '\\') {
-            current_line[current_len - 1] = ' ';
+        if (current_line.len > 1 && current_line.data[current_line.len - 1] == '\\') {
+            current_line.data[current_line.len - 1] = ' ';
             continue;
         }
 
-        char *delimiter = strchr(current_line, '=');
+        char *delimiter = strchr(current_line.data, '=');
         if (delimiter) {
             *delimiter = '\0';
-            char *key = mem_malloc(strlen(current_line) + 1);
-            char *value = mem_malloc(strlen(delimiter + 1) + 1);
-            if (!key || !value) {
-                perror("Out of memory");
-                exit(EXIT_FAILURE);
-            }
-
-            strcpy(key, current_line);
-            strcpy(value, delimiter + 1);
-            char *key_trim = trim_whitespace(key);
-            char *value_trim = trim_whitespace(value);
+            char *key_trim = trim_whitespace(current_line.data);
+            char *value_trim = trim_whitespace(delimiter + 1);
 
             conf_add_key_value(config, key_trim, value_trim);
-
-            mem_free(key);
-            mem_free(value);
         }
 
-        mem_free(current_line);
-        current_line = NULL;
-        current_line_size = 0;
+        current_line.len = 0;
     }
 
-    fclose(file);
+    buffer_free(&current_line);
+    reader_close(&reader);
 }
 
 void conf_cleaning(Config *config) {
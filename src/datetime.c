@@ -0,0 +1,120 @@
+/**
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 43):
+ *
+ * GitHub Co-pilot and <jens@bennerhq.com> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ *
+ * /benner
+ * ----------------------------------------------------------------------------
+ */
+
+/**
+ * datetime.c - ISO 8601 datetimes as seconds since the epoch, with no time
+ *              zone involved
+ */
+#include "../hdr/datetime.h"
+
+#define SECONDS_PER_DAY     (86400)
+
+/**
+ * Reads count digits at str, or returns -1 when one of them isn't a digit.
+ */
+int datetime_digits(const char *str, int count) {
+    int value = 0;
+    for (int index = 0; index < count; index++) {
+        unsigned int digit = (unsigned char) str[index] - '0';
+        if (digit > 9) {
+            return -1;
+        }
+        value = value * 10 + digit;
+    }
+
+    return value;
+}
+
+/**
+ * Days since 1970-01-01 in the proleptic Gregorian calendar. See Howard
+ * Hinnant's "chrono-Compatible Low-Level Date Algorithms".
+ */
+int64_t datetime_days(int64_t year, int month, int day) {
+    year -= month <= 2;
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    int64_t year_of_era = year - era * 400;
+    int64_t day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+
+    return era * 146097 + day_of_era - 719468;
+}
+
+/**
+ * Parses the fixed YYYY-MM-DDTHH:MM:SS layout at the start of the len bytes
+ * at str. Anything after it, like fractions or a zone, is ignored.
+ */
+bool datetime_parse(const char *str, size_t len, int64_t *value) {
+    if (len < DATETIME_LEN ||
+        str[4] != '-' || str[7] != '-' || str[10] != 'T' || str[13] != ':' || str[16] != ':') {
+        return false;
+    }
+
+    int year = datetime_digits(str, 4);
+    int month = datetime_digits(str + 5, 2);
+    int day = datetime_digits(str + 8, 2);
+    int hour = datetime_digits(str + 11, 2);
+    int minute = datetime_digits(str + 14, 2);
+    int second = datetime_digits(str + 17, 2);
+
+    if (year < 0 || month < 1 || month > 12 || day < 1 || day > 31 ||
+        hour < 0 || hour > 23 || minute < 0 || minute > 59 || second < 0 || second > 60) {
+        return false;
+    }
+
+    *value = datetime_days(year, month, day) * SECONDS_PER_DAY + hour * 3600 + minute * 60 + second;
+    return true;
+}
+
+void datetime_put(char *buffer, int value, int count) {
+    for (int index = count - 1; index >= 0; index--) {
+        buffer[index] = '0' + value % 10;
+        value /= 10;
+    }
+}
+
+/**
+ * Formats value as YYYY-MM-DDTHH:MM:SS into buffer, which holds at least
+ * DATETIME_SIZE bytes.
+ */
+void datetime_format(int64_t value, char *buffer) {
+    int64_t days = value / SECONDS_PER_DAY;
+    int64_t seconds = value % SECONDS_PER_DAY;
+    if (seconds < 0) {
+        seconds += SECONDS_PER_DAY;
+        days--;
+    }
+
+    days += 719468;
+    int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    int64_t day_of_era = days - era * 146097;
+    int64_t year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    int64_t day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    int64_t month_index = (5 * day_of_year + 2) / 153;
+
+    int day = (int) (day_of_year - (153 * month_index + 2) / 5 + 1);
+    int month = (int) (month_index < 10 ? month_index + 3 : month_index - 9);
+    int year = (int) (year_of_era + era * 400 + (month <= 2));
+
+    datetime_put(buffer, year, 4);
+    buffer[4] = '-';
+    datetime_put(buffer + 5, month, 2);
+    buffer[7] = '-';
+    datetime_put(buffer + 8, day, 2);
+    buffer[10] = 'T';
+    datetime_put(buffer + 11, (int) (seconds / 3600), 2);
+    buffer[13] = ':';
+    datetime_put(buffer + 14, (int) (seconds / 60 % 60), 2);
+    buffer[16] = ':';
+    datetime_put(buffer + 17, (int) (seconds % 60), 2);
+    buffer[DATETIME_LEN] = '\0';
+}
@@ -0,0 +1,592 @@
+/**
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 43):
+ *
+ * GitHub Co-pilot and <jens@bennerhq.com> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ *
+ * /benner
+ * ----------------------------------------------------------------------------
+ */
+
+/**
+ * dfa.c - Lazy DFA for the extended regex subset 'rin' patterns use
+ *
+ * The pattern becomes a position automaton: one position per character or
+ * bracket expression, and for each position the positions that may follow
+ * it. There are no empty moves, so a DFA state is just a set of positions.
+ * States are made the first time a row needs them, one transition at a time,
+ * and kept in a bounded table shared by all threads. A match walks the
+ * string once and never allocates. When the table is full the rest of the
+ * string runs the position sets directly.
+ *
+ * Literals, escaped specials, '.', bracket expressions with ranges and
+ * [:classes:], groups, '|', '*', '+', '?' and {n,m} are handled, with '^'
+ * first and '$' last in a pattern without a top level '|'. Anything else
+ * makes dfa_compile return NULL, and the caller uses regexec instead.
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "../hdr/dmalloc.h"
+#include "../hdr/dfa.h"
+
+#define DFA_WORDS       (DFA_MAX_POSITIONS / 64)
+#define DFA_MAX_DEPTH   (64)
+#define DFA_SPECIAL     ".[]()*+?{}|^$\\/"
+
+#define DFA_UNKNOWN     (-1)    // Transition not made yet
+#define DFA_START       (0)     // The start position alone
+#define DFA_DEAD        (1)     // No positions, nothing matches from here
+
+// A set of positions, or of bytes for a bracket expression
+typedef struct {
+    uint64_t bits[DFA_WORDS];
+} DfaSet;
+
+// A parsed piece of pattern, the positions it may start and end with
+typedef struct {
+    DfaSet first;
+    DfaSet last;
+    bool nullable;
+} DfaNode;
+
+struct Dfa {
+    bool anchor_start;
+    bool anchor_end;
+    int position_count;
+    DfaSet follow[DFA_MAX_POSITIONS];
+    DfaSet last;
+
+    // Bytes no position tells apart share a class, and a transition column
+    uint8_t classes[256];
+    int class_count;
+    DfaSet by_class[256];
+
+    // States are added under lock, and published by storing the transition
+    pthread_mutex_t lock;
+    int state_count;
+    DfaSet states[DFA_MAX_STATES];
+    bool accepting[DFA_MAX_STATES];
+    _Atomic int32_t *next;
+};
+
+typedef struct {
+    const char *pos;
+    const char *end;
+    Dfa *dfa;
+    DfaSet bytes[DFA_MAX_POSITIONS];
+    int depth;
+    bool alternation;
+    bool failed;
+} DfaParser;
+
+const struct {
+    const char *name;
+    int (*func)(int);
+} dfa_char_classes[] = {
+    {"alpha", isalpha}, {"digit", isdigit}, {"alnum", isalnum}, {"upper", isupper},
+    {"lower", islower}, {"space", isspace}, {"blank", isblank}, {"punct", ispunct},
+    {"print", isprint}, {"graph", isgraph}, {"cntrl", iscntrl}, {"xdigit", isxdigit},
+    {NULL, NULL}
+};
+
+void dfa_set_add(DfaSet *set, int bit) {
+    set->bits[bit >> 6] |= (uint64_t) 1 << (bit & 63);
+}
+
+bool dfa_set_has(const DfaSet *set, int bit) {
+    return (set->bits[bit >> 6] >> (bit & 63)) & 1;
+}
+
+void dfa_set_union(DfaSet *set, const DfaSet *other) {
+    for (int word = 0; word < DFA_WORDS; word++) {
+        set->bits[word] |= other->bits[word];
+    }
+}
+
+bool dfa_set_intersects(const DfaSet *set, const DfaSet *other) {
+    uint64_t any = 0;
+    for (int word = 0; word < DFA_WORDS; word++) {
+        any |= set->bits[word] & other->bits[word];
+    }
+    return any != 0;
+}
+
+/**
+ * Lets every position in to follow every position in from.
+ */
+void dfa_follow(Dfa *dfa, const DfaSet *from, const DfaSet *to) {
+    for (int word = 0; word < DFA_WORDS; word++) {
+        for (uint64_t bits = from->bits[word]; bits; bits &= bits - 1) {
+            dfa_set_union(&dfa->follow[word * 64 + __builtin_ctzll(bits)], to);
+        }
+    }
+}
+
+void dfa_concat(Dfa *dfa, DfaNode *node, const DfaNode *next) {
+    dfa_follow(dfa, &node->last, &next->first);
+
+    if (node->nullable) {
+        dfa_set_union(&node->first, &next->first);
+    }
+    if (next->nullable) {
+        dfa_set_union(&node->last, &next->last);
+    }
+    else {
+        node->last = next->last;
+    }
+    node->nullable = node->nullable && next->nullable;
+}
+
+DfaNode dfa_fail(DfaParser *parser) {
+    parser->failed = true;
+    return (DfaNode) { .nullable = true };
+}
+
+DfaNode dfa_leaf(DfaParser *parser, const DfaSet *bytes) {
+    Dfa *dfa = parser->dfa;
+    if (dfa->position_count >= DFA_MAX_POSITIONS) {
+        return dfa_fail(parser);
+    }
+
+    int position = dfa->position_count++;
+    parser->bytes[position] = *bytes;
+
+    DfaNode node = { .nullable = false };
+    dfa_set_add(&node.first, position);
+    dfa_set_add(&node.last, position);
+    return node;
+}
+
+/**
+ * Parses a bracket expression after its '[' into the bytes it matches.
+ */
+bool dfa_parse_bracket(DfaParser *parser, DfaSet *bytes) {
+    const char *pos = parser->pos;
+    const char *end = parser->end;
+    bool negate = false;
+
+    memset(bytes, 0, sizeof(DfaSet));
+    if (pos < end && *pos == '^') {
+        negate = true;
+        pos++;
+    }
+
+    bool closed = false;
+    for (const char *start = pos; pos < end; ) {
+        unsigned char c = *pos;
+        if (c == ']' && pos != start) {
+            pos++;
+            closed = true;
+            break;
+        }
+
+        if (c == '[' && pos + 1 < end && (pos[1] == '.' || pos[1] == '=')) {
+            return false;
+        }
+        if (c == '[' && pos + 1 < end && pos[1] == ':') {
+            const char *name = pos + 2;
+            const char *name_end = strstr(name, ":]");
+            int index = 0;
+            while (name_end != NULL && dfa_char_classes[index].name != NULL &&
+                   (strlen(dfa_char_classes[index].name) != (size_t) (name_end - name) ||
+                    strncmp(dfa_char_classes[index].name, name, name_end - name) != 0)) {
+                index++;
+            }
+            if (name_end == NULL || dfa_char_classes[index].name == NULL) {
+                return false;
+            }
+
+            for (int byte = 1; byte < 256; byte++) {
+                if (dfa_char_classes[index].func(byte)) {
+                    dfa_set_add(bytes, byte);
+                }
+            }
+            pos = name_end + 2;
+            continue;
+        }
+
+        int low = c;
+        int high = c;
+        pos++;
+        if (pos + 1 < end && *pos == '-' && pos[1] != ']') {
+            high = (unsigned char) pos[1];
+            if (high == '[' || high < low) {
+                return false;
+            }
+            pos += 2;
+        }
+        for (int byte = low; byte <= high; byte++) {
+            dfa_set_add(bytes, byte);
+        }
+    }
+
+    if (!closed) {
+        return false;
+    }
+    if (negate) {
+        for (int word = 0; word < DFA_WORDS; word++) {
+            bytes->bits[word] = ~bytes->bits[word];
+        }
+    }
+    bytes->bits[0] &= ~(uint64_t) 1;
+
+    parser->pos = pos;
+    return true;
+}
+
+DfaNode dfa_parse_alt(DfaParser *parser);
+
+DfaNode dfa_parse_atom(DfaParser *parser) {
+    if (parser->pos >= parser->end) {
+        return dfa_fail(parser);
+    }
+
+    DfaSet bytes = { { 0 } };
+    unsigned char c = *parser->pos++;
+    switch (c) {
+        case '(':
+            {
+                if (++parser->depth > DFA_MAX_DEPTH) {
+                    return dfa_fail(parser);
+                }
+                DfaNode node = dfa_parse_alt(parser);
+                parser->depth--;
+
+                if (parser->pos >= parser->end || *parser->pos != ')') {
+                    return dfa_fail(parser);
+                }
+                parser->pos++;
+                return node;
+            }
+
+        case '[':
+            if (!dfa_parse_bracket(parser, &bytes)) {
+                return dfa_fail(parser);
+            }
+            return dfa_leaf(parser, &bytes);
+
+        case '.':
+            for (int byte = 1; byte < 256; byte++) {
+                dfa_set_add(&bytes, byte);
+            }
+            return dfa_leaf(parser, &bytes);
+
+        case '\\':
+            if (parser->pos >= parser->end || strchr(DFA_SPECIAL, *parser->pos) == NULL) {
+                return dfa_fail(parser);
+            }
+            dfa_set_add(&bytes, (unsigned char) *parser->pos++);
+            return dfa_leaf(parser, &bytes);
+
+        case ')': case '*': case '+': case '?': case '{': case '|': case '^': case '$':
+            return dfa_fail(parser);
+
+        default:
+            dfa_set_add(&bytes, c);
+            return dfa_leaf(parser, &bytes);
+    }
+}
+
+int dfa_parse_count(DfaParser *parser) {
+    int count = -1;
+    while (parser->pos < parser->end && isdigit((unsigned char) *parser->pos) && count <= DFA_MAX_REPEAT) {
+        count = (count < 0 ? 0 : count * 10) + (*parser->pos++ - '0');
+    }
+    return count;
+}
+
+/**
+ * An atom and its quantifier. Counted repeats parse the atom again for each
+ * copy, and the last copy of an open-ended repeat loops back on itself.
+ */
+DfaNode dfa_parse_repeat(DfaParser *parser) {
+    const char *start = parser->pos;
+    DfaNode node = dfa_parse_atom(parser);
+    if (parser->failed || parser->pos >= parser->end) {
+        return node;
+    }
+
+    int min;
+    int max;        // -1 for no upper bound
+    switch (*parser->pos) {
+        case '*': min = 0; max = -1; parser->pos++; break;
+        case '+': min = 1; max = -1; parser->pos++; break;
+        case '?': min = 0; max = 1;  parser->pos++; break;
+        case '{':
+            parser->pos++;
+            min = dfa_parse_count(parser);
+            max = min;
+            if (parser->pos < parser->end && *parser->pos == ',') {
+                parser->pos++;
+                max = dfa_parse_count(parser);
+            }
+            if (min < 0 || min > DFA_MAX_REPEAT || max > DFA_MAX_REPEAT || (max >= 0 && max < min) ||
+                parser->pos >= parser->end || *parser->pos != '}') {
+                return dfa_fail(parser);
+            }
+            parser->pos++;
+            break;
+
+        default:
+            return node;
+    }
+
+    if (parser->pos < parser->end && strchr("*+?{", *parser->pos) != NULL) {
+        return dfa_fail(parser);
+    }
+
+    const char *after = parser->pos;
+    int copies = max >= 0 ? max : (min > 0 ? min : 1);
+
+    DfaNode result = { .nullable = true };
+    for (int index = 0; index < copies && !parser->failed; index++) {
+        if (index > 0) {
+            parser->pos = start;
+            node = dfa_parse_atom(parser);
+        }
+        if (max < 0 && index == copies - 1) {
+            dfa_follow(parser->dfa, &node.last, &node.first);
+        }
+        if (index >= min) {
+            node.nullable = true;
+        }
+        dfa_concat(parser->dfa, &result, &node);
+    }
+
+    parser->pos = after;
+    return result;
+}
+
+DfaNode dfa_parse_seq(DfaParser *parser) {
+    DfaNode node = { .nullable = true };
+    while (!parser->failed && parser->pos < parser->end && *parser->pos != '|' && *parser->pos != ')') {
+        DfaNode next = dfa_parse_repeat(parser);
+        dfa_concat(parser->dfa, &node, &next);
+    }
+    return node;
+}
+
+DfaNode dfa_parse_alt(DfaParser *parser) {
+    DfaNode node = dfa_parse_seq(parser);
+    while (!parser->failed && parser->pos < parser->end && *parser->pos == '|') {
+        parser->pos++;
+        if (parser->depth == 0) {
+            parser->alternation = true;
+        }
+
+        DfaNode next = dfa_parse_seq(parser);
+        dfa_set_union(&node.first, &next.first);
+        dfa_set_union(&node.last, &next.last);
+        node.nullable = node.nullable || next.nullable;
+    }
+    return node;
+}
+
+/**
+ * The state for a set of positions, added when new. DFA_UNKNOWN when the
+ * table is full. Called under lock, or before the DFA is shared.
+ */
+int32_t dfa_state(Dfa *dfa, const DfaSet *set) {
+    for (int state = 0; state < dfa->state_count; state++) {
+        if (memcmp(&dfa->states[state], set, sizeof(DfaSet)) == 0) {
+            return state;
+        }
+    }
+
+    if (dfa->state_count == DFA_MAX_STATES) {
+        return DFA_UNKNOWN;
+    }
+    dfa->states[dfa->state_count] = *set;
+    dfa->accepting[dfa->state_count] = dfa_set_intersects(set, &dfa->last);
+    return dfa->state_count++;
+}
+
+/**
+ * The positions reached from set on a byte of class. The start position
+ * stays in when a match may begin anywhere.
+ */
+void dfa_step(const Dfa *dfa, const DfaSet *set, int class, DfaSet *next) {
+    memset(next, 0, sizeof(DfaSet));
+    for (int word = 0; word < DFA_WORDS; word++) {
+        for (uint64_t bits = set->bits[word]; bits; bits &= bits - 1) {
+            dfa_set_union(next, &dfa->follow[word * 64 + __builtin_ctzll(bits)]);
+        }
+    }
+
+    for (int word = 0; word < DFA_WORDS; word++) {
+        next->bits[word] &= dfa->by_class[class].bits[word];
+    }
+    if (!dfa->anchor_start) {
+        dfa_set_add(next, 0);
+    }
+}
+
+int32_t dfa_transition(Dfa *dfa, int32_t state, int class) {
+    pthread_mutex_lock(&dfa->lock);
+
+    _Atomic int32_t *slot = &dfa->next[state * dfa->class_count + class];
+    int32_t next = atomic_load_explicit(slot, memory_order_relaxed);
+    if (next == DFA_UNKNOWN) {
+        DfaSet set;
+        dfa_step(dfa, &dfa->states[state], class, &set);
+        next = dfa_state(dfa, &set);
+        if (next != DFA_UNKNOWN) {
+            atomic_store_explicit(slot, next, memory_order_release);
+        }
+    }
+
+    pthread_mutex_unlock(&dfa->lock);
+    return next;
+}
+
+/**
+ * Runs the position sets straight from set on, once the state table is full.
+ */
+bool dfa_simulate(const Dfa *dfa, const DfaSet *set, const unsigned char *pos) {
+    DfaSet current = *set;
+    for (;; pos++) {
+        if (dfa_set_intersects(&current, &dfa->last) && (!dfa->anchor_end || *pos == '\0')) {
+            return true;
+        }
+
+        DfaSet next;
+        DfaSet none = { { 0 } };
+        if (*pos == '\0' || memcmp(&current, &none, sizeof(DfaSet)) == 0) {
+            return false;
+        }
+        dfa_step(dfa, &current, dfa->classes[*pos], &next);
+        current = next;
+    }
+}
+
+bool dfa_match(Dfa *dfa, const char *str) {
+    const unsigned char *pos = (const unsigned char *) str;
+    int32_t state = DFA_START;
+
+    for (;; pos++) {
+        if (dfa->accepting[state] && (!dfa->anchor_end || *pos == '\0')) {
+            return true;
+        }
+        if (*pos == '\0' || state == DFA_DEAD) {
+            return false;
+        }
+
+        int class = dfa->classes[*pos];
+        int32_t next = atomic_load_explicit(&dfa->next[state * dfa->class_count + class], memory_order_acquire);
+        if (next == DFA_UNKNOWN) {
+            next = dfa_transition(dfa, state, class);
+            if (next == DFA_UNKNOWN) {
+                return dfa_simulate(dfa, &dfa->states[state], pos);
+            }
+        }
+        state = next;
+    }
+}
+
+/**
+ * Builds the position automaton for an extended regex, NULL when the
+ * pattern is outside the subset.
+ */
+Dfa *dfa_compile(const char *pattern) {
+    Dfa *dfa = (Dfa *) mem_malloc(sizeof(Dfa));
+    DfaParser *parser = (DfaParser *) mem_malloc(sizeof(DfaParser));
+    if (dfa == NULL || parser == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(dfa, 0, sizeof(Dfa));
+
+    const char *begin = pattern;
+    const char *end = pattern + strlen(pattern);
+    if (*begin == '^') {
+        dfa->anchor_start = true;
+        begin++;
+    }
+    if (end > begin && end[-1] == '$') {
+        const char *escape = end - 1;
+        while (escape > begin && escape[-1] == '\\') {
+            escape--;
+        }
+        if ((end - 1 - escape) % 2 == 0) {
+            dfa->anchor_end = true;
+            end--;
+        }
+    }
+
+    // Position 0 is the start, followed by the positions a match begins with
+    *parser = (DfaParser) { .pos = begin, .end = end, .dfa = dfa };
+    dfa->position_count = 1;
+
+    DfaNode node = dfa_parse_alt(parser);
+    if (parser->failed || parser->pos != end ||
+        (parser->alternation && (dfa->anchor_start || dfa->anchor_end))) {
+        mem_free(parser);
+        mem_free(dfa);
+        return NULL;
+    }
+
+    dfa->follow[0] = node.first;
+    dfa->last = node.last;
+    if (node.nullable) {
+        dfa_set_add(&dfa->last, 0);
+    }
+
+    for (int byte = 0; byte < 256; byte++) {
+        DfaSet signature = { { 0 } };
+        for (int position = 1; position < dfa->position_count; position++) {
+            if (dfa_set_has(&parser->bytes[position], byte)) {
+                dfa_set_add(&signature, position);
+            }
+        }
+
+        int class = 0;
+        while (class < dfa->class_count && memcmp(&dfa->by_class[class], &signature, sizeof(DfaSet)) != 0) {
+            class++;
+        }
+        if (class == dfa->class_count) {
+            dfa->by_class[dfa->class_count++] = signature;
+        }
+        dfa->classes[byte] = class;
+    }
+    mem_free(parser);
+
+    size_t transitions = (size_t) DFA_MAX_STATES * dfa->class_count;
+    dfa->next = (_Atomic int32_t *) mem_malloc(transitions * sizeof(_Atomic int32_t));
+    if (dfa->next == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t index = 0; index < transitions; index++) {
+        atomic_init(&dfa->next[index], DFA_UNKNOWN);
+    }
+    pthread_mutex_init(&dfa->lock, NULL);
+
+    DfaSet start = { { 0 } };
+    DfaSet dead = { { 0 } };
+    dfa_set_add(&start, 0);
+    dfa_state(dfa, &start);
+    dfa_state(dfa, &dead);
+
+    return dfa;
+}
+
+void dfa_free(Dfa *dfa) {
+    if (dfa == NULL) {
+        return;
+    }
+
+    pthread_mutex_destroy(&dfa->lock);
+    mem_free(dfa->next);
+    mem_free(dfa);
+}
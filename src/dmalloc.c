@@ -10,11 +10,13 @@
  * /benner
  * ----------------------------------------------------------------------------
  */
+#define _GNU_SOURCE
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <execinfo.h>
+#include <pthread.h>
 
 #include "../hdr/dmalloc.h" 
 
@@ -22,7 +24,7 @@
 #define COLOR_GREEN     "\033[32m"
 #define COLOR_RESET     "\033[0m"
 
-#define HEAD_MAGIC      "HEAD_MAGIC"
+#define HEAD_MAGIC      "HEAD_MAGIC_____"   // 16 bytes, keeps user memory aligned
 #define TAIL_MAGIC      "TAIL_MAGIC"
 #define HEAD_MAGIC_SIZE (sizeof(HEAD_MAGIC))
 #define TAIL_MAGIC_SIZE (sizeof(TAIL_MAGIC))
@@ -37,6 +39,9 @@ typedef struct MemTrack {
 
 MemTrack *mem_track_head = NULL;
 
+pthread_mutex_t mem_track_lock;
+pthread_once_t mem_track_once = PTHREAD_ONCE_INIT;
+
 #if !MALLOC_DEBUG
     void *mem_realloc(void *ptr, size_t size, size_t old_size) {
         old_size = old_size * 0;
@@ -45,6 +50,27 @@ MemTrack *mem_track_head = NULL;
     }
 #endif
 
+/**
+ * The tracking list is shared by all worker threads. The lock is recursive,
+ * as debug_realloc() and the integrity checks call back into the allocator.
+ */
+void debug_lock_init() {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&mem_track_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+void debug_lock() {
+    pthread_once(&mem_track_once, debug_lock_init);
+    pthread_mutex_lock(&mem_track_lock);
+}
+
+void debug_unlock() {
+    pthread_mutex_unlock(&mem_track_lock);
+}
+
 void debug_dumphex(MemTrack *ptr) {
     if (!MALLOC_HEXDUMP) return;
 
@@ -122,6 +148,7 @@ void debug_check_ptr(void *user_ptr, const char *file, int line) {
 }
 
 void *debug_malloc(size_t size, const char *file, int line) {
+    debug_lock();
     mem_integrity();
 
     void *ptr = malloc(size + HEAD_MAGIC_SIZE + TAIL_MAGIC_SIZE);
@@ -144,15 +171,17 @@ void *debug_malloc(size_t size, const char *file, int line) {
         fprintf(stderr, COLOR_GREEN "malloc %p at %s:%d\n" COLOR_RESET, ptr, file, line);
 #endif
     }
+    debug_unlock();
 
     return (char*) ptr;
 }
 
 void debug_free(void *user_ptr, const char *file, int line) {
-    mem_integrity();
-
     if (!user_ptr) return;
 
+    debug_lock();
+    mem_integrity();
+
     debug_check_ptr(user_ptr, file, line);
 
     void *ptr = (char *)user_ptr - HEAD_MAGIC_SIZE;
@@ -171,9 +200,11 @@ void debug_free(void *user_ptr, const char *file, int line) {
         current = &(*current)->next;
     }
     free(ptr);
+    debug_unlock();
 }
 
 void *debug_realloc(void* ptr, size_t size, size_t old_size, const char *file, int line) {
+    debug_lock();
     mem_integrity();
 
     void *new_ptr = debug_malloc(size, file, line);
@@ -183,14 +214,14 @@ void *debug_realloc(void* ptr, size_t size, size_t old_size, const char *file, i
             memcpy(new_ptr, ptr, new_size);
             debug_free(ptr, file, line);
         }
-
-        return new_ptr;
     }
+    debug_unlock();
 
-    return NULL;
+    return new_ptr;
 }
 
 void debug_cleaning(const char *file, int line) {
+    debug_lock();
     MemTrack *current = mem_track_head;
     while (current) {
         debug_check_ptr(current->ptr + HEAD_MAGIC_SIZE, file, line);
@@ -200,12 +231,15 @@ void debug_cleaning(const char *file, int line) {
 
         current = current->next;
     }
+    debug_unlock();
 }
 
 void debug_integrity() {
+    debug_lock();
     MemTrack *current = mem_track_head;
     while (current) {
         debug_check_ptr(current->ptr + HEAD_MAGIC_SIZE, current->file, current->line);
         current = current->next;
     }   
+    debug_unlock();
 }
@@ -18,368 +18,629 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
-#include <regex.h>
 
 #include "../hdr/dmalloc.h"
 #include "../hdr/exec.h"
 #include "../hdr/expr.h"
-
-#define MAX_STACK_SIZE      (1024)
-#define STACK_SIZE_BUFFER   (10)
+#include "../hdr/datetime.h"
+#include "../hdr/match.h"
+#include "../hdr/set.h"
+#include "../hdr/aho.h"
+
+// GCC and clang jump straight from one instruction to the next through a
+// label table, other compilers use the switch
+#if defined(__GNUC__) && !defined(EXEC_SWITCH)
+#   define EXEC_THREADED
+#   define EXEC_LABEL(op)       [op] = &&label_##op
+#   define EXEC_CASE(op)        label_##op
+#   define EXEC_DISPATCH        goto *labels[ip->op]
+#else
+#   define EXEC_CASE(op)        case op
+#   define EXEC_DISPATCH        continue
+#endif
+#define EXEC_NEXT               ip++; EXEC_DISPATCH
 
 const char *op_names[] = {
     "NOP",
-    "PUSH %d",
-    "PUSH %s [%d]",
-    "PUSH '%s'",
+    "PUSH ",
+    "PUSH ",
+    "PUSH ",
+    "LOAD# %s [%d]",
+    "LOAD$ %s [%d]",
+    "LOAD@ %s [%d]",
     "JP   %03X",
     "JPZ  %03X",
     "HALT",
+    "JPZ& %03X",
+    "JPNZ| %03X",
+    "BOOL#",
 
     "ADD",  "SUB",  "MUL",  "DIV",  "NEQ",  "LE",  "GE",  "LT",  "GT",  "EQ",  "AND",  "OR",  "NOT",
     "ADD#", "SUB#", "MUL#", "DIV#", "NEQ#", "LE#", "GE#", "LT#", "GT#", "EQ#", "AND#", "OR#", "NOT#",
+    "IN#  ",
     "ADD$", "SUB$", "MUL$", "DIV$", "NEQ$", "LE$", "GE$", "LT$", "GT$", "EQ$", "AND$", "OR$", "NOT$",
 
-    "IN$",  "XIN$", "UP$",  "LO$"
-};
+    "IN$",  "XIN$", "UP$",  "LO$",  "XIN$ ", "IN$  ", "ANY$ ",
 
-void print_instruction(const Variable *instr, const Variable *variables) {
-    const char *fmt = op_names[instr->op];
+    "ADD@", "SUB@", "MUL@", "DIV@", "NEQ@", "LE@", "GE@", "LT@", "GT@", "EQ@", "AND@", "OR@", "NOT@",
 
-    if (instr->op == OP_PUSH_VAR) {
-        printf(fmt, variables[(int) instr->value].name, (int) instr->value);
-    }
-    else if (strstr(fmt, "%d") || strstr(fmt, "%03X")) {
-        printf(fmt, (int) instr->value);
-    } 
-    else if (strstr(fmt, "%s")) {
-        printf(fmt, instr->str);
-    } 
-    else {
-        printf("%s", fmt);
-    }
+    "NEQ# %s [%d], ", "LE#  %s [%d], ", "GE#  %s [%d], ", "LT#  %s [%d], ", "GT#  %s [%d], ", "EQ#  %s [%d], ",
+    "NEQ$ %s [%d], ", "LE$  %s [%d], ", "GE$  %s [%d], ", "LT$  %s [%d], ", "GT$  %s [%d], ", "EQ$  %s [%d], ",
+    "NEQ@ %s [%d], ", "LE@  %s [%d], ", "GE@  %s [%d], ", "LT@  %s [%d], ", "GT@  %s [%d], ", "EQ@  %s [%d], "
+};
 
-    printf("\n");
-}
+void print_constant(FILE *file, const Variable *constant) {
+    switch (constant->type) {
+        case VAR_NUMBER:
+            fprintf(file, "%g", constant->value);
+            break;
 
-void execute_print_code(const Variable *code, const Variable *variables) {
-    const Variable *ip = code - 1;
-    do {
-        ip ++;
+        case VAR_STRING:
+            fprintf(file, "'%s'", constant->str);
+            break;
 
-        printf("0x%03X\t", (int) (ip - code));
-        print_instruction(ip, variables);
-     } while (ip->op != OP_HALT);
-}
+        case VAR_SET:
+            fprintf(file, "{%d}", set_count(constant->set));
+            break;
 
-void print_stack(Variable *stack, Variable *sp) {
-    for (Variable *vp = stack; vp < sp; vp++) {
-        printf("%d: %d ", (int) (vp - stack), (int) vp->type);
-        switch (vp->type) {
-            case VAR_NUMBER:
-                printf("%f\n", vp->value);
-                break;
+        case VAR_AHO:
+            fprintf(file, "{%d}", aho_count(constant->aho));
+            break;
 
-            case VAR_STRING:
-                printf("%s\n", vp->str);
-                break;
+        case VAR_REGEX:
+            fprintf(file, "/%s/", match_pattern(constant->match));
+            break;
 
-            case VAR_DATETIME:
-                {
-                    char buffer[20];
-                    strftime(buffer, sizeof(buffer), DATE_FORMAT, &vp->datetime);
-                    printf("%s\n", buffer);
-                }
-                break;
-            default:
-                printf("Unknown type\n");
-                break;
-        }
+        case VAR_DATETIME:
+            {
+                char buffer[DATETIME_SIZE];
+                datetime_format(constant->datetime, buffer);
+                fprintf(file, "@%s", buffer);
+            }
+            break;
     }
 }
 
-int strregex(const char *str, const char *pattern) {
-    regex_t regex;
+void print_instruction(FILE *file, const Program *program, const Instr *instr, const Variable *variables) {
+    const char *fmt = op_names[instr->op];
+
+    if (instr->op >= OP_BASE_VC_NUM) {
+        int index = INSTR_VAR(instr->arg);
+        fprintf(file, fmt, variables[index].name, index);
+        print_constant(file, &program->constants[INSTR_CONSTANT(instr->arg)]);
+    }
+    else switch (instr->op) {
+        case OP_PUSH_NUM:
+        case OP_PUSH_STR:
+        case OP_PUSH_DT:
+        case OP_IN_REGEX_C_STR:
+        case OP_IN_SET_NUM:
+        case OP_IN_SET_STR:
+        case OP_IN_ANY_STR:
+            fprintf(file, "%s", fmt);
+            print_constant(file, &program->constants[instr->arg]);
+            break;
+
+        case OP_LOAD_NUM:
+        case OP_LOAD_STR:
+        case OP_LOAD_DT:
+            fprintf(file, fmt, variables[instr->arg].name, instr->arg);
+            break;
 
-    int ret = regcomp(&regex, pattern, REG_EXTENDED);
-    if (ret) return 0;
+        case OP_JP:
+        case OP_JPZ:
+        case OP_JPZ_AND:
+        case OP_JPNZ_OR:
+            fprintf(file, fmt, instr->arg);
+            break;
 
-    ret = regexec(&regex, str, 0, NULL, 0);
-    regfree(&regex);
+        default:
+            fprintf(file, "%s", fmt);
+            break;
+    }
 
-    // Return 1 if match found, 0 otherwise
-    return !ret;
+    fprintf(file, "\n");
 }
 
-void to_strcase(Variable *sp, int (*func)(int)) {
-    char *copy = (char *) mem_malloc(strlen(sp->str) + 1);
-    if (copy == NULL) {
-        fprintf(stderr, "Out of memory\n");
-        exit(EXIT_FAILURE);
-    }
-    strcpy(copy, sp->str);
-    if (sp->is_dynamic) mem_free((void *) sp->str);
+void execute_print_code(FILE *file, const Program *program, const Variable *variables) {
+    fprintf(file, "%d instructions, %d before optimization, stack %d\n",
+        program->code_size, program->parsed_size, program->max_stack);
 
-    for (char *p = copy; *p; p++) {
-        *p = func(*p);
+    for (int index = 0; index < program->code_size; index++) {
+        fprintf(file, "0x%03X\t", index);
+        print_instruction(file, program, &program->code[index], variables);
     }
+}
 
-    sp->type = VAR_STRING;
+void to_strcase(Variable *sp, int (*func)(int), Arena *arena) {
+    size_t len = strlen(sp->str);
+    char *copy = arena_alloc(arena, len + 1);
+    for (size_t index = 0; index <= len; index++) {
+        copy[index] = (char) func((unsigned char) sp->str[index]);
+    }
     sp->str = copy;
-    sp->is_dynamic = true;
 }
 
-Variable execute_code_datatype(const Variable *code, const Variable *variables) {
-    Variable stack[MAX_STACK_SIZE]; // Not thread safe
-    Variable* sp = stack;
+/**
+ * A copy of str without the len bytes at cut, made in the arena.
+ */
+const char *str_cut(const char *str, const char *cut, size_t len, Arena *arena) {
+    size_t head = cut - str;
+    size_t tail = strlen(cut + len);
+    char *result = arena_alloc(arena, head + tail + 1);
+    memcpy(result, str, head);
+    memcpy(result + head, cut + len, tail + 1);
+    return result;
+}
 
-    for (const Variable *ip = code; ip->op != OP_HALT; ip++) {
-        if ((sp - stack) + STACK_SIZE_BUFFER >= MAX_STACK_SIZE) {
-            fprintf(stderr, "Error: Stack overflow!\n");
-            exit(EXIT_FAILURE);
-        }
+/**
+ * How many values op leaves on the stack, minus the ones it takes.
+ */
+int execute_stack_effect(OpCode op) {
+    if (op >= OP_BASE_VC_NUM) {
+        return 1;
+    }
 
-        int op = ip->op;
-re_type:
-        switch (op) {
-            case OP_NOP:
-                break;
-            case OP_JP:
-                ip = code + (int) ip->value - 1;
-                break;
-            case OP_JPZ:
+    switch (op) {
+        case OP_PUSH_NUM:
+        case OP_PUSH_STR:
+        case OP_PUSH_DT:
+        case OP_LOAD_NUM:
+        case OP_LOAD_STR:
+        case OP_LOAD_DT:
+            return 1;
+
+        case OP_NOP:
+        case OP_JP:
+        case OP_HALT:
+        case OP_NOT_NUM:
+        case OP_NOT_STR:
+        case OP_NOT_DT:
+        case OP_BOOL:
+        case OP_UPPER_STR:
+        case OP_LOWER_STR:
+        case OP_IN_REGEX_C_STR:
+        case OP_IN_SET_NUM:
+        case OP_IN_SET_STR:
+        case OP_IN_ANY_STR:
+            return 0;
+
+        default:
+            return -1;
+    }
+}
+
+/**
+ * Runs program on a row. The strings it makes live in arena, until the
+ * caller resets it.
+ */
+Variable execute_code_datatype(const Program *program, const Variable *variables, Arena *arena) {
+    // The compiler checked that program->max_stack fits
+    Variable stack[MAX_STACK_SIZE];
+    Variable* sp = stack;
+    const Instr *code = program->code;
+    const Variable *constants = program->constants;
+    const Instr *ip = code;
+
+#ifdef EXEC_THREADED
+    static const void *const labels[OP_COUNT] = {
+        EXEC_LABEL(OP_NOP),       EXEC_LABEL(OP_PUSH_NUM),  EXEC_LABEL(OP_PUSH_STR),  EXEC_LABEL(OP_PUSH_DT),
+        EXEC_LABEL(OP_LOAD_NUM),  EXEC_LABEL(OP_LOAD_STR),  EXEC_LABEL(OP_LOAD_DT),
+        EXEC_LABEL(OP_JP),        EXEC_LABEL(OP_JPZ),       EXEC_LABEL(OP_HALT),
+        EXEC_LABEL(OP_JPZ_AND),   EXEC_LABEL(OP_JPNZ_OR),   EXEC_LABEL(OP_BOOL),
+
+        [OP_ADD] = &&op_unknown,  [OP_SUB] = &&op_unknown,  [OP_MUL] = &&op_unknown,  [OP_DIV] = &&op_unknown,
+        [OP_NEQ] = &&op_unknown,  [OP_LE] = &&op_unknown,   [OP_GE] = &&op_unknown,   [OP_LT] = &&op_unknown,
+        [OP_GT] = &&op_unknown,   [OP_EQ] = &&op_unknown,   [OP_AND] = &&op_unknown,  [OP_OR] = &&op_unknown,
+        [OP_NOT] = &&op_unknown,
+
+        EXEC_LABEL(OP_ADD_NUM),   EXEC_LABEL(OP_SUB_NUM),   EXEC_LABEL(OP_MUL_NUM),   EXEC_LABEL(OP_DIV_NUM),
+        EXEC_LABEL(OP_NEQ_NUM),   EXEC_LABEL(OP_LE_NUM),    EXEC_LABEL(OP_GE_NUM),    EXEC_LABEL(OP_LT_NUM),
+        EXEC_LABEL(OP_GT_NUM),    EXEC_LABEL(OP_EQ_NUM),    EXEC_LABEL(OP_AND_NUM),   EXEC_LABEL(OP_OR_NUM),
+        EXEC_LABEL(OP_NOT_NUM),   EXEC_LABEL(OP_IN_SET_NUM),
+
+        EXEC_LABEL(OP_ADD_STR),   EXEC_LABEL(OP_SUB_STR),   EXEC_LABEL(OP_MUL_STR),   EXEC_LABEL(OP_DIV_STR),
+        EXEC_LABEL(OP_NEQ_STR),   EXEC_LABEL(OP_LE_STR),    EXEC_LABEL(OP_GE_STR),    EXEC_LABEL(OP_LT_STR),
+        EXEC_LABEL(OP_GT_STR),    EXEC_LABEL(OP_EQ_STR),    EXEC_LABEL(OP_AND_STR),   EXEC_LABEL(OP_OR_STR),
+        EXEC_LABEL(OP_NOT_STR),   EXEC_LABEL(OP_IN_STR),    EXEC_LABEL(OP_IN_REGEX_STR),
+        EXEC_LABEL(OP_UPPER_STR), EXEC_LABEL(OP_LOWER_STR), EXEC_LABEL(OP_IN_REGEX_C_STR),
+        EXEC_LABEL(OP_IN_SET_STR), EXEC_LABEL(OP_IN_ANY_STR),
+
+        [OP_ADD_DT] = &&op_unknown, EXEC_LABEL(OP_SUB_DT),
+        [OP_MUL_DT] = &&op_unknown, [OP_DIV_DT] = &&op_unknown,
+        EXEC_LABEL(OP_NEQ_DT),    EXEC_LABEL(OP_LE_DT),     EXEC_LABEL(OP_GE_DT),     EXEC_LABEL(OP_LT_DT),
+        EXEC_LABEL(OP_GT_DT),     EXEC_LABEL(OP_EQ_DT),
+        [OP_AND_DT] = &&op_unknown, [OP_OR_DT] = &&op_unknown, [OP_NOT_DT] = &&op_unknown,
+
+        EXEC_LABEL(OP_NEQ_VC_NUM), EXEC_LABEL(OP_LE_VC_NUM), EXEC_LABEL(OP_GE_VC_NUM),
+        EXEC_LABEL(OP_LT_VC_NUM),  EXEC_LABEL(OP_GT_VC_NUM), EXEC_LABEL(OP_EQ_VC_NUM),
+        EXEC_LABEL(OP_NEQ_VC_STR), EXEC_LABEL(OP_LE_VC_STR), EXEC_LABEL(OP_GE_VC_STR),
+        EXEC_LABEL(OP_LT_VC_STR),  EXEC_LABEL(OP_GT_VC_STR), EXEC_LABEL(OP_EQ_VC_STR),
+        EXEC_LABEL(OP_NEQ_VC_DT),  EXEC_LABEL(OP_LE_VC_DT),  EXEC_LABEL(OP_GE_VC_DT),
+        EXEC_LABEL(OP_LT_VC_DT),   EXEC_LABEL(OP_GT_VC_DT),  EXEC_LABEL(OP_EQ_VC_DT)
+    };
+
+    EXEC_DISPATCH;
+    {
+#else
+    for (;;) {
+        switch (ip->op) {
+#endif
+            EXEC_CASE(OP_NOP):
+                EXEC_NEXT;
+            EXEC_CASE(OP_HALT):
+                goto halt;
+            EXEC_CASE(OP_JP):
+                ip = code + ip->arg;
+                EXEC_DISPATCH;
+            EXEC_CASE(OP_JPZ):
                 if (!(*--sp).value) {
-                    ip = code + (int) ip->value - 1;
+                    ip = code + ip->arg;
+                    EXEC_DISPATCH;
                 }
-                break;
-            case OP_PUSH_NUM:
-                sp->type = VAR_NUMBER;
-                sp->value = ip->value;
-                sp->is_dynamic = false;
+                EXEC_NEXT;
+            EXEC_CASE(OP_JPZ_AND):
+                if (!sp[-1].value) {
+                    sp[-1].value = 0;
+                    ip = code + ip->arg;
+                    EXEC_DISPATCH;
+                }
+                sp--;
+                EXEC_NEXT;
+            EXEC_CASE(OP_JPNZ_OR):
+                if (sp[-1].value) {
+                    sp[-1].value = 1;
+                    ip = code + ip->arg;
+                    EXEC_DISPATCH;
+                }
+                sp--;
+                EXEC_NEXT;
+            EXEC_CASE(OP_BOOL):
+                sp[-1].value = (sp[-1].value != 0);
+                EXEC_NEXT;
+            // Typed loads, copying only the value
+            EXEC_CASE(OP_PUSH_NUM):
+                sp->value = constants[ip->arg].value;
+                sp++;
+                EXEC_NEXT;
+            EXEC_CASE(OP_PUSH_STR):
+                sp->str = constants[ip->arg].str;
                 sp++;
-                break;
-            case OP_PUSH_STR:
-                sp->type = VAR_STRING;
-                sp->str = ip->str;
-                sp->is_dynamic = false;
+                EXEC_NEXT;
+            EXEC_CASE(OP_PUSH_DT):
+                sp->datetime = constants[ip->arg].datetime;
                 sp++;
-                break;
-            case OP_PUSH_VAR:
-                (*sp) = variables[(int) ip->value];
-                sp->is_dynamic = false;
-                sp ++;
-                break;
-
-            // Dynamic type
-            case OP_ADD: case OP_SUB: case OP_MUL:
-            case OP_DIV: case OP_EQ:  case OP_NEQ:
-            case OP_LT:  case OP_GT:  case OP_LE:
-            case OP_GE:  case OP_AND: case OP_OR: 
-            case OP_NOT:
-                op = (sp->type == VAR_NUMBER) ? OP_BASE_NUM + (op - OP_BASE) : OP_BASE_STR + (op - OP_BASE);
-                goto re_type;
+                EXEC_NEXT;
+            EXEC_CASE(OP_LOAD_NUM):
+                sp->value = variables[ip->arg].value;
+                sp++;
+                EXEC_NEXT;
+            EXEC_CASE(OP_LOAD_STR):
+                sp->str = variables[ip->arg].str;
+                sp++;
+                EXEC_NEXT;
+            EXEC_CASE(OP_LOAD_DT):
+                sp->datetime = variables[ip->arg].datetime;
+                sp++;
+                EXEC_NEXT;
 
             // Number type
-            case OP_ADD_NUM:
+            EXEC_CASE(OP_ADD_NUM):
                 sp--;
                 sp[-1].value += sp[0].value;
-                break;
-            case OP_SUB_NUM:
+                EXEC_NEXT;
+            EXEC_CASE(OP_SUB_NUM):
                 sp--;
                 sp[-1].value -= sp[0].value;
-                break;
-            case OP_MUL_NUM:
+                EXEC_NEXT;
+            EXEC_CASE(OP_MUL_NUM):
                 sp--;
                 sp[-1].value *= sp[0].value;
-                break;
-            case OP_DIV_NUM:
+                EXEC_NEXT;
+            EXEC_CASE(OP_DIV_NUM):
                 sp--;
                 if (sp[0].value == 0) {
                     fprintf(stderr, "Division by zero!\n");
                     exit(EXIT_FAILURE);
                 }
                 sp[-1].value /= sp[0].value;
-                break;
-            case OP_EQ_NUM:
+                EXEC_NEXT;
+            EXEC_CASE(OP_EQ_NUM):
                 sp --;
                 sp[-1].value = (sp[-1].value == sp[0].value);
-                break;
-            case OP_NEQ_NUM:
+                EXEC_NEXT;
+            EXEC_CASE(OP_NEQ_NUM):
                 sp --;
                 sp[-1].value = (sp[-1].value != sp[0].value);
-                break;
-            case OP_LT_NUM:
+                EXEC_NEXT;
+            EXEC_CASE(OP_LT_NUM):
                 sp --;
                 sp[-1].value = (sp[-1].value < sp[0].value);
-                break;
-            case OP_GT_NUM:
+                EXEC_NEXT;
+            EXEC_CASE(OP_GT_NUM):
                 sp --;
                 sp[-1].value = (sp[-1].value > sp[0].value);
-                break;
-            case OP_LE_NUM:
+                EXEC_NEXT;
+            EXEC_CASE(OP_LE_NUM):
                 sp --;
                 sp[-1].value = (sp[-1].value <= sp[0].value);
-                break;
-            case OP_GE_NUM:
+                EXEC_NEXT;
+            EXEC_CASE(OP_GE_NUM):
                 sp --;
                 sp[-1].value = (sp[-1].value >= sp[0].value);
-                break;
-            case OP_AND_NUM:
+                EXEC_NEXT;
+            EXEC_CASE(OP_AND_NUM):
                 sp--;
                 sp[-1].value = (sp[-1].value && sp[0].value);
-                break;
-            case OP_OR_NUM:
+                EXEC_NEXT;
+            EXEC_CASE(OP_OR_NUM):
                 sp--;
                 sp[-1].value = (sp[-1].value || sp[0].value);
-                break;
-            case OP_NOT_NUM:
+                EXEC_NEXT;
+            EXEC_CASE(OP_NOT_NUM):
                 sp[-1].value = !sp[-1].value;
-                break;
+                EXEC_NEXT;
+            EXEC_CASE(OP_IN_SET_NUM):
+                sp[-1].value = set_contains_number(constants[ip->arg].set, sp[-1].value);
+                EXEC_NEXT;
 
             // String type
-            case OP_EQ_STR:
+            EXEC_CASE(OP_EQ_STR):
                 sp--;
-                sp[-1].type = VAR_NUMBER;
                 sp[-1].value = strncmp(sp[-1].str, sp[0].str, strlen(sp[0].str)) == 0;
-                break;
-            case OP_ADD_STR:
+                EXEC_NEXT;
+            EXEC_CASE(OP_ADD_STR):
                 {
                     sp--;
                     size_t len1 = strlen(sp[-1].str);
                     size_t len2 = strlen(sp[0].str);
-                    char *result = (char *) mem_malloc(len1 + len2 + 1);
-                    if (result == NULL) {
-                        fprintf(stderr, "Out of memory\n");
-                        exit(EXIT_FAILURE);
-                    }
-                    strcpy(result, sp[-1].str);
-                    strcat(result, sp[0].str);
-
-                    if (sp[0].is_dynamic) {
-                        mem_free((void *) sp[0].str);
-                        sp[0].str = NULL;
-                        sp[0].is_dynamic = false;
-                    }
+                    char *result = arena_alloc(arena, len1 + len2 + 1);
+                    memcpy(result, sp[-1].str, len1);
+                    memcpy(result + len1, sp[0].str, len2 + 1);
                     sp[-1].str = result;
-                    sp[-1].is_dynamic = true;
                 }
-                break;
-            case OP_SUB_STR:
+                EXEC_NEXT;
+            EXEC_CASE(OP_SUB_STR):
                 {
                     sp --;
-                    char *pos = strstr(sp[-1].str, sp[0].str);
+                    const char *pos = strstr(sp[-1].str, sp[0].str);
                     if (pos) {
-                        size_t len1 = strlen(sp[-1].str);
-                        size_t len2 = strlen(sp[0].str);
-                        memmove(pos, pos + len2, len1 - len2 + 1);
+                        sp[-1].str = str_cut(sp[-1].str, pos, strlen(sp[0].str), arena);
                     }
                 }
-                break;
-            case OP_MUL_STR:
+                EXEC_NEXT;
+            EXEC_CASE(OP_MUL_STR):
                 {
                     sp--;
-                    int repeat = (int) sp[0].value;
+                    size_t repeat = sp[0].value > 0 ? (size_t) sp[0].value : 0;
                     size_t len = strlen(sp[-1].str);
-                    char *result = (char *) mem_malloc(len * repeat + 1);
-                    if (result == NULL) {
-                        fprintf(stderr, "Out of memory\n");
-                        exit(EXIT_FAILURE);
+                    char *result = arena_alloc(arena, len * repeat + 1);
+
+                    // Doubling what is already copied, log(repeat) memcpys
+                    size_t done = len * repeat > 0 ? len : 0;
+                    memcpy(result, sp[-1].str, done);
+                    while (done < len * repeat) {
+                        size_t part = done < len * repeat - done ? done : len * repeat - done;
+                        memcpy(result + done, result, part);
+                        done += part;
                     }
-
-                    result[0] = '\0';
-                    for (int i = 0; i < repeat; i++) {
-                        strcat(result, sp[-1].str);
-                    }
-
-                    if (sp[-1].is_dynamic) mem_free((void *) sp[-1].str);
-
+                    result[done] = '\0';
                     sp[-1].str = result;
-                    sp[-1].is_dynamic = true;
                 }
-                break;
-            case OP_DIV_STR:
+                EXEC_NEXT;
+            EXEC_CASE(OP_DIV_STR):
                 {
                     sp--;
-                    char *pos = strstr(sp[-1].str, sp[0].str);
+                    const char *pos = strstr(sp[-1].str, sp[0].str);
                     if (pos) {
-                        *pos = '\0';
+                        sp[-1].str = str_cut(sp[-1].str, pos, strlen(pos), arena);
                     }
                 }
-                break;
-            case OP_NEQ_STR:
+                EXEC_NEXT;
+            EXEC_CASE(OP_NEQ_STR):
                 sp--;
-                sp[-1].type = VAR_NUMBER;
                 sp[-1].value = strncmp(sp[-1].str, sp[0].str, strlen(sp[0].str)) != 0;
-                break;
-            case OP_LE_STR:
+                EXEC_NEXT;
+            EXEC_CASE(OP_LE_STR):
                 sp--;
-                sp[-1].type = VAR_NUMBER;
                 sp[-1].value = strncmp(sp[-1].str, sp[0].str, strlen(sp[0].str)) <= 0;
-                break;
-            case OP_GE_STR:
+                EXEC_NEXT;
+            EXEC_CASE(OP_GE_STR):
                 sp--;
-                sp[-1].type = VAR_NUMBER;
                 sp[-1].value = strncmp(sp[-1].str, sp[0].str, strlen(sp[0].str)) >= 0;
-                break;
-            case OP_LT_STR:
+                EXEC_NEXT;
+            EXEC_CASE(OP_LT_STR):
                 sp--;
-                sp[-1].type = VAR_NUMBER;
                 sp[-1].value = strncmp(sp[-1].str, sp[0].str, strlen(sp[0].str)) < 0;
-                break;
-            case OP_GT_STR:
+                EXEC_NEXT;
+            EXEC_CASE(OP_GT_STR):
                 sp--;
-                sp[-1].type = VAR_NUMBER;
                 sp[-1].value = strncmp(sp[-1].str, sp[0].str, strlen(sp[0].str)) > 0;
-                break;
-            case OP_AND_STR:
+                EXEC_NEXT;
+            EXEC_CASE(OP_AND_STR):
                 sp--;
-                sp[-1].type = VAR_NUMBER;
                 sp[-1].value = (strlen(sp[-1].str) > 0 && strlen(sp[0].str) > 0);
-                break;
-            case OP_OR_STR:
+                EXEC_NEXT;
+            EXEC_CASE(OP_OR_STR):
                 sp--;
-                sp[-1].type = VAR_NUMBER;
                 sp[-1].value = (strlen(sp[-1].str) > 0 || strlen(sp[0].str) > 0);
-                break;
-            case OP_NOT_STR:
-                sp[-1].type = VAR_NUMBER;
+                EXEC_NEXT;
+            EXEC_CASE(OP_NOT_STR):
                 sp[-1].value = (strlen(sp[-1].str) == 0);
-                break;
-            case OP_IN_STR:
+                EXEC_NEXT;
+            EXEC_CASE(OP_IN_STR):
                 sp--;
-                sp[-1].type = VAR_NUMBER;
                 sp[-1].value = (strlen(sp[-1].str) > 0) && (strstr(sp[0].str, sp[-1].str) != 0);
-                break;
-            case OP_IN_REGEX_STR:
+                EXEC_NEXT;
+            EXEC_CASE(OP_IN_REGEX_STR):
+                sp--;
+                sp[-1].value = match_dynamic(sp[-1].str, sp[0].str);
+                EXEC_NEXT;
+            EXEC_CASE(OP_IN_REGEX_C_STR):
+                sp[-1].value = match_exec(constants[ip->arg].match, sp[-1].str);
+                EXEC_NEXT;
+            EXEC_CASE(OP_IN_SET_STR):
+                sp[-1].value = set_contains(constants[ip->arg].set, sp[-1].str, strlen(sp[-1].str));
+                EXEC_NEXT;
+            EXEC_CASE(OP_IN_ANY_STR):
+                sp[-1].value = aho_search(constants[ip->arg].aho, sp[-1].str);
+                EXEC_NEXT;
+            EXEC_CASE(OP_UPPER_STR):
+                to_strcase(&sp[-1], toupper, arena);
+                EXEC_NEXT;
+            EXEC_CASE(OP_LOWER_STR):
+                to_strcase(&sp[-1], tolower, arena);
+                EXEC_NEXT;
+
+            // Datetime type, plain integer compares
+            EXEC_CASE(OP_SUB_DT):
+                sp--;
+                sp[-1].value = (double) (sp[-1].datetime - sp[0].datetime);
+                EXEC_NEXT;
+            EXEC_CASE(OP_EQ_DT):
                 sp--;
-                sp[-1].type = VAR_NUMBER;
-                sp[-1].value = (strlen(sp[-1].str) > 0) && (strregex(sp[0].str, sp[-1].str) != 0);
-                break;
-            case OP_UPPER_STR:
-                to_strcase(&sp[-1], toupper);
-                break;
-            case OP_LOWER_STR:
-                to_strcase(&sp[-1], tolower);
-                break;
+                sp[-1].value = (sp[-1].datetime == sp[0].datetime);
+                EXEC_NEXT;
+            EXEC_CASE(OP_NEQ_DT):
+                sp--;
+                sp[-1].value = (sp[-1].datetime != sp[0].datetime);
+                EXEC_NEXT;
+            EXEC_CASE(OP_LT_DT):
+                sp--;
+                sp[-1].value = (sp[-1].datetime < sp[0].datetime);
+                EXEC_NEXT;
+            EXEC_CASE(OP_GT_DT):
+                sp--;
+                sp[-1].value = (sp[-1].datetime > sp[0].datetime);
+                EXEC_NEXT;
+            EXEC_CASE(OP_LE_DT):
+                sp--;
+                sp[-1].value = (sp[-1].datetime <= sp[0].datetime);
+                EXEC_NEXT;
+            EXEC_CASE(OP_GE_DT):
+                sp--;
+                sp[-1].value = (sp[-1].datetime >= sp[0].datetime);
+                EXEC_NEXT;
+
+            // Column compared with a constant, one dispatch for load, push and compare
+            EXEC_CASE(OP_NEQ_VC_NUM):
+                sp->value = (variables[INSTR_VAR(ip->arg)].value != constants[INSTR_CONSTANT(ip->arg)].value);
+                sp++;
+                EXEC_NEXT;
+            EXEC_CASE(OP_LE_VC_NUM):
+                sp->value = (variables[INSTR_VAR(ip->arg)].value <= constants[INSTR_CONSTANT(ip->arg)].value);
+                sp++;
+                EXEC_NEXT;
+            EXEC_CASE(OP_GE_VC_NUM):
+                sp->value = (variables[INSTR_VAR(ip->arg)].value >= constants[INSTR_CONSTANT(ip->arg)].value);
+                sp++;
+                EXEC_NEXT;
+            EXEC_CASE(OP_LT_VC_NUM):
+                sp->value = (variables[INSTR_VAR(ip->arg)].value < constants[INSTR_CONSTANT(ip->arg)].value);
+                sp++;
+                EXEC_NEXT;
+            EXEC_CASE(OP_GT_VC_NUM):
+                sp->value = (variables[INSTR_VAR(ip->arg)].value > constants[INSTR_CONSTANT(ip->arg)].value);
+                sp++;
+                EXEC_NEXT;
+            EXEC_CASE(OP_EQ_VC_NUM):
+                sp->value = (variables[INSTR_VAR(ip->arg)].value == constants[INSTR_CONSTANT(ip->arg)].value);
+                sp++;
+                EXEC_NEXT;
+            EXEC_CASE(OP_NEQ_VC_STR):
+                {
+                    const char *constant = constants[INSTR_CONSTANT(ip->arg)].str;
+                    sp->value = strncmp(variables[INSTR_VAR(ip->arg)].str, constant, strlen(constant)) != 0;
+                    sp++;
+                }
+                EXEC_NEXT;
+            EXEC_CASE(OP_LE_VC_STR):
+                {
+                    const char *constant = constants[INSTR_CONSTANT(ip->arg)].str;
+                    sp->value = strncmp(variables[INSTR_VAR(ip->arg)].str, constant, strlen(constant)) <= 0;
+                    sp++;
+                }
+                EXEC_NEXT;
+            EXEC_CASE(OP_GE_VC_STR):
+                {
+                    const char *constant = constants[INSTR_CONSTANT(ip->arg)].str;
+                    sp->value = strncmp(variables[INSTR_VAR(ip->arg)].str, constant, strlen(constant)) >= 0;
+                    sp++;
+                }
+                EXEC_NEXT;
+            EXEC_CASE(OP_LT_VC_STR):
+                {
+                    const char *constant = constants[INSTR_CONSTANT(ip->arg)].str;
+                    sp->value = strncmp(variables[INSTR_VAR(ip->arg)].str, constant, strlen(constant)) < 0;
+                    sp++;
+                }
+                EXEC_NEXT;
+            EXEC_CASE(OP_GT_VC_STR):
+                {
+                    const char *constant = constants[INSTR_CONSTANT(ip->arg)].str;
+                    sp->value = strncmp(variables[INSTR_VAR(ip->arg)].str, constant, strlen(constant)) > 0;
+                    sp++;
+                }
+                EXEC_NEXT;
+            EXEC_CASE(OP_EQ_VC_STR):
+                {
+                    const char *constant = constants[INSTR_CONSTANT(ip->arg)].str;
+                    sp->value = strncmp(variables[INSTR_VAR(ip->arg)].str, constant, strlen(constant)) == 0;
+                    sp++;
+                }
+                EXEC_NEXT;
+            EXEC_CASE(OP_NEQ_VC_DT):
+                sp->value = (variables[INSTR_VAR(ip->arg)].datetime != constants[INSTR_CONSTANT(ip->arg)].datetime);
+                sp++;
+                EXEC_NEXT;
+            EXEC_CASE(OP_LE_VC_DT):
+                sp->value = (variables[INSTR_VAR(ip->arg)].datetime <= constants[INSTR_CONSTANT(ip->arg)].datetime);
+                sp++;
+                EXEC_NEXT;
+            EXEC_CASE(OP_GE_VC_DT):
+                sp->value = (variables[INSTR_VAR(ip->arg)].datetime >= constants[INSTR_CONSTANT(ip->arg)].datetime);
+                sp++;
+                EXEC_NEXT;
+            EXEC_CASE(OP_LT_VC_DT):
+                sp->value = (variables[INSTR_VAR(ip->arg)].datetime < constants[INSTR_CONSTANT(ip->arg)].datetime);
+                sp++;
+                EXEC_NEXT;
+            EXEC_CASE(OP_GT_VC_DT):
+                sp->value = (variables[INSTR_VAR(ip->arg)].datetime > constants[INSTR_CONSTANT(ip->arg)].datetime);
+                sp++;
+                EXEC_NEXT;
+            EXEC_CASE(OP_EQ_VC_DT):
+                sp->value = (variables[INSTR_VAR(ip->arg)].datetime == constants[INSTR_CONSTANT(ip->arg)].datetime);
+                sp++;
+                EXEC_NEXT;
 
+#ifndef EXEC_THREADED
             default:
-                fprintf(stderr, "Error: Unknown op code %d!\n", op);
-                exit(EXIT_FAILURE);
+                goto op_unknown;
         }
+#endif
     }
 
+op_unknown:
+    fprintf(stderr, "Error: Unknown op code %d!\n", ip->op);
+    exit(EXIT_FAILURE);
+
+halt:
     sp --;
     if (sp != stack) {
         fprintf(stderr, "Error: No results!\n");
         exit(EXIT_FAILURE);
     }
 
-    return *sp;
+    // Stack values carry no type, the compiler knows the result's
+    Variable result = *sp;
+    result.type = program->type;
+    return result;
 }
 
-double execute_code(const Variable *code, const Variable *variables) {
+double execute_code(const Program *program, const Variable *variables, Arena *arena) {
     double value = 0;
-    Variable result = execute_code_datatype(code, variables);
+    Variable result = execute_code_datatype(program, variables, arena);
 
     switch (result.type) {
         case VAR_NUMBER:
@@ -388,7 +649,6 @@ double execute_code(const Variable *code, const Variable *variables) {
 
         case VAR_STRING:
             value = strlen(result.str) > 0;
-            if (result.is_dynamic) mem_free((void *) result.str);
             break;
 
         case VAR_DATETIME:
@@ -23,6 +23,10 @@
 #include "../hdr/dmalloc.h"
 #include "../hdr/exec.h"
 #include "../hdr/expr.h"
+#include "../hdr/datetime.h"
+#include "../hdr/match.h"
+#include "../hdr/set.h"
+#include "../hdr/aho.h"
 
 #define IS_SPACE        " \t\n\r\v\f"
 #define IS_INT          "0123456789"
@@ -53,8 +57,10 @@ typedef struct {
  
     Variable *variables;
 
-    Variable *code;
+    Instr *code;
     int code_size;
+    Variable *constants;
+    int constant_count;
 
     OpCode op;
     DataType type;
@@ -174,6 +180,7 @@ void next_token_str(ParseState *state, char find) {
         parse_fatal(state, "Out of memory\n");
     }
     strncpy(str, start, len);
+    str[len] = '\0';
     state->op = TOK_VAR_STR;
     state->str = str;
 
@@ -227,40 +234,111 @@ void next_token(ParseState *state) {
     parse_fatal(state, "Undefined symbol '%c'\n", *state->expr);
 }
 
-void emit_overflow(ParseState *state) {
+void emit(ParseState *state, OpCode op, int32_t arg) {
     if (state->code_size + 1 >= MAX_CODE_SIZE) {
         parse_fatal(state, "Program overflow!\n");
     }
-}
-
-void emit(ParseState *state, OpCode op, double value, DataType type) {
-    emit_overflow(state);
 
-    state->code[state->code_size++] = (Variable) {
+    state->code[state->code_size++] = (Instr) {
         .op = op, 
-        .value = value, 
-        .type = type
+        .arg = arg
     };
 }
 
-void emit_str(ParseState *state, OpCode op, const char *str) {
-    emit_overflow(state);
+int emit_constant(ParseState *state, Variable constant) {
+    if (state->constant_count + 1 >= MAX_CODE_SIZE) {
+        parse_fatal(state, "Too many constants!\n");
+    }
 
-    state->code[state->code_size++] = (Variable) {
-        .op = op, 
-        .str = str, 
-        .type = VAR_STRING
-    };
+    constant.is_dynamic = false;
+    state->constants[state->constant_count] = constant;
+    return state->constant_count++;
+}
+
+void emit_num(ParseState *state, double value) {
+    emit(state, OP_PUSH_NUM, emit_constant(state, (Variable) { .type = VAR_NUMBER, .value = value }));
+}
+
+void emit_str(ParseState *state, const char *str) {
+    emit(state, OP_PUSH_STR, emit_constant(state, (Variable) { .type = VAR_STRING, .str = str }));
+}
+
+/**
+ * Pushes a copy of value as a constant.
+ */
+DataType emit_value(ParseState *state, const Variable *value) {
+    switch (value->type) {
+        case VAR_NUMBER:
+            emit_num(state, value->value);
+            break;
+
+        case VAR_STRING:
+            {
+                char *str = (char *) mem_malloc(strlen(value->str) + 1);
+                if (str == NULL) {
+                    parse_fatal(state, "Out of memory\n");
+                }
+                strcpy(str, value->str);
+                emit_str(state, str);
+            }
+            break;
+
+        case VAR_DATETIME:
+            emit(state, OP_PUSH_DT, emit_constant(state, (Variable) { .type = VAR_DATETIME, .datetime = value->datetime }));
+            break;
+
+        default:
+            parse_fatal(state, "Variable '%s' has no type\n", value->name);
+    }
+    return value->type;
 }
 
-void emit_type(ParseState *state, DataType data_type, OpCode op, DataType data_type_result) {
+/**
+ * Loads variable index with the load for its type, returning the type. A
+ * config variable never changes, so its value is pushed as a constant.
+ */
+DataType emit_load(ParseState *state, int index) {
+    const Variable *var = &state->variables[index];
+    if (var->is_constant) {
+        return emit_value(state, var);
+    }
+
+    DataType data_type = var->type;
     switch (data_type) {
+        case VAR_NUMBER:
+            emit(state, OP_LOAD_NUM, index);
+            break;
+
         case VAR_STRING:
-            emit(state, OP_BASE_STR + (op - OP_BASE), 0, data_type_result);
+            emit(state, OP_LOAD_STR, index);
+            break;
+
+        case VAR_DATETIME:
+            emit(state, OP_LOAD_DT, index);
+            break;
+
+        default:
+            parse_fatal(state, "Variable '%s' has no type\n", state->variables[index].name);
+    }
+    return data_type;
+}
+
+void emit_type(ParseState *state, DataType data_type, OpCode op) {
+    switch (data_type) {
+        case VAR_STRING:
+            emit(state, OP_BASE_STR + (op - OP_BASE), 0);
             break;
 
         case VAR_NUMBER:
-            emit(state, OP_BASE_NUM + (op - OP_BASE), 0, data_type_result);
+            emit(state, OP_BASE_NUM + (op - OP_BASE), 0);
+            break;
+
+        case VAR_DATETIME:
+            if (op != OP_SUB && op != OP_EQ && op != OP_NEQ &&
+                op != OP_LT && op != OP_GT && op != OP_LE && op != OP_GE) {
+                parse_fatal(state, "Datetimes can only be compared or subtracted\n");
+            }
+            emit(state, OP_BASE_DT + (op - OP_BASE), 0);
             break;
 
         default:
@@ -268,6 +346,32 @@ void emit_type(ParseState *state, DataType data_type, OpCode op, DataType data_t
     }
 }
 
+/**
+ * A quoted literal next to a datetime, the code from start to end, is parsed
+ * once here so the rows are compared as integers.
+ */
+void parse_datetime_literal(ParseState *state, int start, int end, DataType *data_type, DataType other_type) {
+    Instr *ip = &state->code[start];
+    if (*data_type != VAR_STRING || other_type != VAR_DATETIME || end - start != 1 || ip->op != OP_PUSH_STR) {
+        return;
+    }
+
+    Variable *constant = &state->constants[ip->arg];
+    int64_t datetime;
+    if (strlen(constant->str) != DATETIME_LEN || !datetime_parse(constant->str, DATETIME_LEN, &datetime)) {
+        parse_fatal(state, "'%s' is not a YYYY-MM-DDTHH:MM:SS datetime\n", constant->str);
+    }
+
+    mem_free((void *) constant->str);
+    *constant = (Variable) {
+        .type = VAR_DATETIME,
+        .datetime = datetime,
+        .is_dynamic = false
+    };
+    ip->op = OP_PUSH_DT;
+    *data_type = VAR_DATETIME;
+}
+
 DataType parse_expr(ParseState *state) {
     DataType data_type = VAR_UNKNOWN;
 
@@ -285,22 +389,25 @@ DataType parse_expr(ParseState *state) {
 }
 
 DataType parse_arithmetic_expr(ParseState *state) {
+    int start_left = state->code_size;
     DataType data_type_left = parse_term(state);
     while (state->op == OP_ADD || state->op == OP_SUB) {
         OpCode op = state->op;
 
         next_token(state);
+        int start_right = state->code_size;
         DataType data_type_right = parse_term(state);
 
+        parse_datetime_literal(state, start_left, start_right, &data_type_left, data_type_right);
+        parse_datetime_literal(state, start_right, state->code_size, &data_type_right, data_type_left);
         if (data_type_left != data_type_right) {
             parse_fatal(state, "Mismatched types in arithmetic expression\n");
         }
 
-        if (data_type_left == VAR_STRING) {
-            emit_type(state, data_type_left, op, VAR_NUMBER);
-        }
-        else {
-            emit_type(state, data_type_left, op, VAR_NUMBER);
+        emit_type(state, data_type_left, op);
+        if (data_type_left == VAR_DATETIME) {
+            // The difference of two datetimes is a number of seconds
+            data_type_left = VAR_NUMBER;
         }
     }
     return data_type_left;
@@ -320,44 +427,82 @@ DataType parse_term(ParseState *state) {
                 if (data_type_right != VAR_NUMBER) {
                     parse_fatal(state, "Multiplay string must be number!\n");
                 }
-                emit(state, OP_MUL_STR, 0, VAR_STRING);
+                emit(state, OP_MUL_STR, 0);
             }
             else {
-                emit(state, OP_DIV_STR, 0, VAR_STRING);
+                emit(state, OP_DIV_STR, 0);
             }
         }
         else {
-            emit_type(state, data_type_left, op, VAR_STRING);
+            emit_type(state, data_type_left, op);
         }
     }
 
     return data_type_left;
 }
 
+/**
+ * file('path') loads a set with one entry per line while parsing. It is only
+ * an operand for 'in', the NOP left in the code holds the set's constant.
+ */
+DataType parse_file(ParseState *state) {
+    next_token(state);
+    if (state->op != TOK_LPAREN) {
+        parse_fatal(state, "Expected '(' after file\n");
+    }
+    next_token(state);
+
+    int start = state->code_size;
+    DataType data_type = parse_expr(state);
+    if (state->op != TOK_RPAREN) {
+        parse_fatal(state, "Expected ')'\n");
+    }
+    if (data_type != VAR_STRING || state->code_size - start != 1 || state->code[start].op != OP_PUSH_STR) {
+        parse_fatal(state, "file() takes a constant file name\n");
+    }
+
+    Variable *constant = &state->constants[state->code[start].arg];
+    Set *set = set_load(constant->str);
+    if (set == NULL) {
+        parse_fatal(state, "Can't read '%s'\n", constant->str);
+    }
+    mem_free((void *) constant->str);
+    *constant = (Variable) { .type = VAR_SET, .set = set };
+    state->code[start].op = OP_NOP;
+
+    next_token(state);
+    return VAR_SET;
+}
+
 DataType parse_factor(ParseState *state) {
     DataType data_type = VAR_UNKNOWN;
 
     switch (state->op) {
         case TOK_NUMBER:
-            emit(state, OP_PUSH_NUM, state->value, VAR_NUMBER);
+            emit_num(state, state->value);
             next_token(state);
             data_type = VAR_NUMBER;
             break;
 
         case TOK_VAR_STR:
-            emit_str(state, OP_PUSH_STR, state->str);
+            emit_str(state, state->str);
 
             next_token(state);
             data_type = VAR_STRING;
             break;
 
         case TOK_ID_NAME: {
+            const char *next = state->expr;
+            while (next < state->expr_end && strchr(IS_SPACE, *next)) next++;
+            if (strcmp(state->name, "file") == 0 && next < state->expr_end && *next == '(') {
+                data_type = parse_file(state);
+                break;
+            }
+
             bool found = false;
             for (int i = 0; state->variables[i].type != VAR_END; i++) {
                 if (strncmp(state->variables[i].name, state->name, strlen(state->name)) == 0) {
-                    emit(state, OP_PUSH_VAR, i, data_type);
-
-                    data_type = state->variables[i].type;
+                    data_type = emit_load(state, i);
                     next_token(state);
 
                     found = true;
@@ -371,11 +516,18 @@ DataType parse_factor(ParseState *state) {
             break;
         }
 
-        case TOK_VAR_IDX:
-            emit(state, OP_PUSH_VAR, state->value, VAR_NUMBER);
+        case TOK_VAR_IDX: {
+            int index = (int) state->value;
+            for (int i = 0; i <= index; i++) {
+                if (state->variables[i].type == VAR_END) {
+                    parse_fatal(state, "Undefined variable #%d\n", index);
+                }
+            }
+
+            data_type = emit_load(state, index);
             next_token(state);
-            data_type = VAR_NUMBER;
             break;
+        }
 
         case TOK_LPAREN:
             next_token(state);
@@ -394,17 +546,71 @@ DataType parse_factor(ParseState *state) {
     return data_type;
 }
 
+bool parse_is_jump(OpCode op) {
+    return op == OP_JP || op == OP_JPZ || op == OP_JPZ_AND || op == OP_JPNZ_OR;
+}
+
+/**
+ * True for the ops that leave 0 or 1 on the stack.
+ */
+bool parse_is_boolean(OpCode op) {
+    return (op >= OP_NEQ_NUM && op <= OP_IN_SET_NUM) ||
+           (op >= OP_NEQ_STR && op <= OP_IN_REGEX_STR) || (op >= OP_IN_REGEX_C_STR && op <= OP_IN_ANY_STR) ||
+           (op >= OP_NEQ_DT && op <= OP_EQ_DT) ||
+           (op >= OP_BASE_VC_NUM && op < OP_COUNT) ||
+           op == OP_BOOL;
+}
+
+/**
+ * True when the code from start on always ends with 0 or 1 on the stack, so
+ * the right side of a short-circuit needs no OP_BOOL after it. Only the end
+ * of a condition can jump past a last compare with something else.
+ */
+bool parse_ends_boolean(ParseState *state, int start) {
+    if (!parse_is_boolean(state->code[state->code_size - 1].op)) {
+        return false;
+    }
+    for (int index = start; index < state->code_size; index++) {
+        const Instr *ip = &state->code[index];
+        if (ip->op == OP_JP && ip->arg == state->code_size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Numbers short-circuit, the left side jumps past the right side when it
+ * decides the result, leaving 0 for '&' and 1 for '|'. Strings evaluate both
+ * sides.
+ */
 DataType parse_bool(ParseState *state, OpCode op, DataType (*parse_bool_func)(ParseState *state)) {
     DataType data_type_left = parse_bool_func(state);
     while (state->op == op) {
         next_token(state);
+
+        int code_jump = state->code_size;
+        if (data_type_left == VAR_NUMBER) {
+            emit(state, op == OP_AND ? OP_JPZ_AND : OP_JPNZ_OR, 0);
+        }
+
+        int code_right = state->code_size;
         DataType data_type_right = parse_bool_func(state);
 
         if (data_type_left != data_type_right) {
             parse_fatal(state, "Mismatched types in boolean expression\n");
         }
 
-        emit_type(state, data_type_left, op, VAR_NUMBER);
+        if (data_type_left == VAR_NUMBER) {
+            if (!parse_ends_boolean(state, code_right)) {
+                emit(state, OP_BOOL, 0);
+            }
+            state->code[code_jump].arg = state->code_size;
+        }
+        else {
+            emit_type(state, data_type_left, op);
+        }
+        data_type_left = VAR_NUMBER;
     }
     return data_type_left;
 }
@@ -423,21 +629,21 @@ DataType parse_bool_factor(ParseState *state) {
     OpCode op = state->op;
     switch (op) {
         case TOK_TRUE:
-            emit(state, OP_PUSH_NUM, 1, VAR_NUMBER);
+            emit_num(state, 1);
             next_token(state);
             data_type = VAR_NUMBER;
             break;
 
         case TOK_FALSE:
-            emit(state, OP_PUSH_NUM, 0, VAR_NUMBER);
+            emit_num(state, 0);
             next_token(state);
             data_type = VAR_NUMBER;
             break;
 
         case OP_NOT:
             next_token(state);
-            data_type = parse_bool_factor(state);
-            emit(state, op, 0, VAR_NUMBER);
+            emit_type(state, parse_bool_factor(state), op);
+            data_type = VAR_NUMBER;
             break;
 
         case OP_UPPER_STR:
@@ -447,7 +653,7 @@ DataType parse_bool_factor(ParseState *state) {
             if (data_type != VAR_STRING) {
                 parse_fatal(state, "String expected'\n");
             }
-            emit(state, op, 0, VAR_STRING);
+            emit(state, op, 0);
             break;
 
         case TOK_LPAREN:
@@ -467,7 +673,54 @@ DataType parse_bool_factor(ParseState *state) {
     return data_type;
 }
 
+/**
+ * A literal 'rin' pattern is compiled here, once. Its push is dropped and the
+ * match reads the compiled pattern from the constant instead.
+ */
+void parse_regex_literal(ParseState *state, int push) {
+    Variable *constant = &state->constants[state->code[push].arg];
+    Match *match = match_compile(constant->str);
+    if (match == NULL) {
+        parse_fatal(state, "Invalid regular expression '%s'\n", constant->str);
+    }
+
+    mem_free((void *) constant->str);
+    *constant = (Variable) { .type = VAR_REGEX, .match = match };
+
+    emit(state, OP_IN_REGEX_C_STR, state->code[push].arg);
+    state->code[push].op = OP_NOP;
+}
+
+/**
+ * The constant holding the set an 'in' looks up in, or -1 when the right
+ * side is a plain string to search. A constant list of quoted strings is
+ * made a set here, so 'TRITON' no longer matches inside 'TRITONX'.
+ */
+int parse_set_operand(ParseState *state, int start, DataType data_type) {
+    bool single = state->code_size - start == 1;
+    if (data_type == VAR_SET) {
+        if (!single || state->code[start].op != OP_NOP) {
+            parse_fatal(state, "file() can only be looked up with 'in'\n");
+        }
+        return state->code[start].arg;
+    }
+    if (data_type != VAR_STRING || !single || state->code[start].op != OP_PUSH_STR) {
+        return -1;
+    }
+
+    Variable *constant = &state->constants[state->code[start].arg];
+    Set *set = set_parse_list(constant->str);
+    if (set == NULL) {
+        return -1;
+    }
+    mem_free((void *) constant->str);
+    *constant = (Variable) { .type = VAR_SET, .set = set };
+    state->code[start].op = OP_NOP;
+    return state->code[start].arg;
+}
+
 DataType parse_rel_expr(ParseState *state) {
+    int start_left = state->code_size;
     DataType data_type_left = parse_arithmetic_expr(state);
     if (state->op == OP_EQ || state->op == OP_NEQ || 
         state->op == OP_LT || state->op == OP_GT || 
@@ -476,20 +729,35 @@ DataType parse_rel_expr(ParseState *state) {
         OpCode op = state->op;
 
         next_token(state);
+        int start_right = state->code_size;
         DataType data_type_right = parse_arithmetic_expr(state);
 
-        if (op == OP_IN_STR || op == OP_IN_REGEX_STR) {
+        parse_datetime_literal(state, start_left, start_right, &data_type_left, data_type_right);
+        parse_datetime_literal(state, start_right, state->code_size, &data_type_right, data_type_left);
+        int set = op == OP_IN_STR ? parse_set_operand(state, start_right, data_type_right) : -1;
+        if (set >= 0) {
+            if (data_type_left != VAR_STRING && data_type_left != VAR_NUMBER) {
+                parse_fatal(state, "Mismatched types in 'in' expression\n");
+            }
+            emit(state, data_type_left == VAR_NUMBER ? OP_IN_SET_NUM : OP_IN_SET_STR, set);
+        }
+        else if (op == OP_IN_STR || op == OP_IN_REGEX_STR) {
             if (data_type_left != VAR_STRING || data_type_right != VAR_STRING) {
                 parse_fatal(state, "Mismatched types in 'in' or 'rin' expression\n");
             }
-            emit(state, op, 0, VAR_NUMBER);
+            if (op == OP_IN_REGEX_STR && start_right - start_left == 1 && state->code[start_left].op == OP_PUSH_STR) {
+                parse_regex_literal(state, start_left);
+            }
+            else {
+                emit(state, op, 0);
+            }
         }
         else {
             if (data_type_left != data_type_right) {
                 parse_fatal(state, "Mismatched types in relational expression\n");
             }
 
-            emit_type(state, data_type_left, op, VAR_NUMBER);
+            emit_type(state, data_type_left, op);
         }
         data_type_left = VAR_NUMBER;
     }
@@ -503,15 +771,18 @@ DataType parse_cond_expr(ParseState *state) {
         return data_type;
     }
 
+    if (data_type != VAR_NUMBER) {
+        parse_fatal(state, "Condition must be a number or comparison\n");
+    }
     next_token(state);
 
     int code_false_branch = state->code_size;
-    emit(state, OP_JPZ, 0, VAR_UNKNOWN);
+    emit(state, OP_JPZ, 0);
 
     DataType data_type_true = parse_expr(state);   // Parse true branch
 
     int code_jump_end = state->code_size;
-    emit(state, OP_JP, 0, VAR_UNKNOWN);
+    emit(state, OP_JP, 0);
 
     if (state->op != TOK_COLON) {
         parse_fatal(state, "Expected ':' for conditional expression\n");
@@ -525,45 +796,495 @@ DataType parse_cond_expr(ParseState *state) {
         parse_fatal(state, "Mismatched types in condition expression\n");
     }
 
-    state->code[code_false_branch].value = code_false;
-    state->code[code_jump_end].value = state->code_size;
+    state->code[code_false_branch].arg = code_false;
+    state->code[code_jump_end].arg = state->code_size;
 
     return data_type_true;
 }
 
-void parse_cleaning(Variable const *code) {
-    if (code == NULL) {
+void parse_cleaning(const Program *program) {
+    if (program == NULL) {
         return;
     }
 
-    for (const Variable *ip = code; ip->op != OP_HALT; ip++) {
-        if (ip->op == OP_PUSH_STR) {
-            mem_free((void *) ip->str);
+    for (int index = 0; index < program->constant_count; index++) {
+        if (program->constants[index].type == VAR_STRING) {
+            mem_free((void *) program->constants[index].str);
+        }
+        else if (program->constants[index].type == VAR_REGEX) {
+            match_free((Match *) program->constants[index].match);
+        }
+        else if (program->constants[index].type == VAR_SET) {
+            set_free((Set *) program->constants[index].set);
+        }
+        else if (program->constants[index].type == VAR_AHO) {
+            aho_free((Aho *) program->constants[index].aho);
+        }
+    }
+    mem_free((void *) program);
+}
+
+/**
+ * Marks the variables the program reads in used, indexed like the variable
+ * table given to parse_expression and count entries long.
+ */
+void parse_used_variables(const Program *program, bool *used, int count) {
+    for (int index = 0; index < program->code_size; index++) {
+        const Instr *ip = &program->code[index];
+        bool is_load = ip->op == OP_LOAD_NUM || ip->op == OP_LOAD_STR || ip->op == OP_LOAD_DT;
+        int var = ip->op >= OP_BASE_VC_NUM ? INSTR_VAR(ip->arg) : is_load ? ip->arg : count;
+        if (var < count) {
+            used[var] = true;
+        }
+    }
+}
+
+/**
+ * The fused compare for a load, a constant push and a compare of one type, or
+ * OP_NOP when the three don't match.
+ */
+OpCode parse_fused_compare(OpCode load, OpCode push, OpCode compare) {
+    if (load == OP_LOAD_NUM && push == OP_PUSH_NUM && compare >= OP_NEQ_NUM && compare <= OP_EQ_NUM) {
+        return OP_BASE_VC_NUM + (compare - OP_NEQ_NUM);
+    }
+    if (load == OP_LOAD_STR && push == OP_PUSH_STR && compare >= OP_NEQ_STR && compare <= OP_EQ_STR) {
+        return OP_BASE_VC_STR + (compare - OP_NEQ_STR);
+    }
+    if (load == OP_LOAD_DT && push == OP_PUSH_DT && compare >= OP_NEQ_DT && compare <= OP_EQ_DT) {
+        return OP_BASE_VC_DT + (compare - OP_NEQ_DT);
+    }
+    return OP_NOP;
+}
+
+/**
+ * Marks every instruction a jump lands on.
+ */
+void parse_targets(const ParseState *state, bool *is_target) {
+    memset(is_target, 0, (state->code_size + 1) * sizeof(bool));
+    for (int index = 0; index < state->code_size; index++) {
+        const Instr *ip = &state->code[index];
+        if (parse_is_jump(ip->op)) {
+            is_target[ip->arg] = true;
+        }
+    }
+}
+
+/**
+ * Drops the OP_NOPs the passes leave behind and moves the jumps along, a
+ * jump to a dropped instruction lands on the next one kept.
+ */
+void parse_compact(ParseState *state) {
+    int moved[MAX_CODE_SIZE + 1];
+
+    int size = 0;
+    for (int index = 0; index < state->code_size; index++) {
+        moved[index] = size;
+        if (state->code[index].op != OP_NOP) {
+            state->code[size++] = state->code[index];
+        }
+    }
+    moved[state->code_size] = size;
+
+    for (int index = 0; index < size; index++) {
+        Instr *ip = &state->code[index];
+        if (parse_is_jump(ip->op)) {
+            ip->arg = moved[ip->arg];
         }
     }
-    mem_free((void*) code);
+    state->code_size = size;
 }
 
-const Variable *parse_expression(const char *iexpr, Variable *ivariables) {
+/**
+ * Evaluates a number op on two constants like the VM does, false for the ops
+ * left to run time, division by zero among them.
+ */
+bool parse_fold_number(OpCode op, double left, double right, double *value) {
+    switch (op) {
+        case OP_ADD_NUM:    *value = left + right;   return true;
+        case OP_SUB_NUM:    *value = left - right;   return true;
+        case OP_MUL_NUM:    *value = left * right;   return true;
+        case OP_DIV_NUM:
+            if (right == 0) {
+                return false;
+            }
+            *value = left / right;
+            return true;
+        case OP_NEQ_NUM:    *value = (left != right); return true;
+        case OP_LE_NUM:     *value = (left <= right); return true;
+        case OP_GE_NUM:     *value = (left >= right); return true;
+        case OP_LT_NUM:     *value = (left < right);  return true;
+        case OP_GT_NUM:     *value = (left > right);  return true;
+        case OP_EQ_NUM:     *value = (left == right); return true;
+        case OP_AND_NUM:    *value = (left && right); return true;
+        case OP_OR_NUM:     *value = (left || right); return true;
+        default:            return false;
+    }
+}
+
+/**
+ * Evaluates a datetime subtraction or compare of two constants.
+ */
+bool parse_fold_datetime(OpCode op, int64_t left, int64_t right, double *value) {
+    switch (op) {
+        case OP_SUB_DT:     *value = (double) (left - right); return true;
+        case OP_NEQ_DT:     *value = (left != right); return true;
+        case OP_LE_DT:      *value = (left <= right); return true;
+        case OP_GE_DT:      *value = (left >= right); return true;
+        case OP_LT_DT:      *value = (left < right);  return true;
+        case OP_GT_DT:      *value = (left > right);  return true;
+        case OP_EQ_DT:      *value = (left == right); return true;
+        default:            return false;
+    }
+}
+
+/**
+ * Folds ops on constants into one push, and conditional jumps on a constant
+ * into a jump or nothing. The push's constant slot is reused for the result,
+ * nothing is folded when a jump lands between the instructions.
+ */
+bool parse_fold(ParseState *state) {
+    bool is_target[MAX_CODE_SIZE + 1];
+    parse_targets(state, is_target);
+
+    bool changed = false;
+    for (int index = 0; index + 1 < state->code_size; index++) {
+        Instr *ip = &state->code[index];
+
+        // "x & true" and "x | false" are x, when x already is 0 or 1
+        if ((ip[0].op == OP_JPZ_AND || ip[0].op == OP_JPNZ_OR) && ip[0].arg == index + 2 &&
+            ip[1].op == OP_PUSH_NUM && index > 0 && !is_target[index] && !is_target[index + 1] &&
+            parse_is_boolean(ip[-1].op) &&
+            (ip[0].op == OP_JPZ_AND) == (state->constants[ip[1].arg].value != 0)) {
+            ip[0].op = ip[1].op = OP_NOP;
+            changed = true;
+            continue;
+        }
+
+        if ((ip[0].op != OP_PUSH_NUM && ip[0].op != OP_PUSH_DT) || is_target[index + 1]) {
+            continue;
+        }
+
+        Variable *constant = &state->constants[ip[0].arg];
+        if (ip[0].op == OP_PUSH_NUM) {
+            double value = constant->value;
+            switch (ip[1].op) {
+                case OP_NOT_NUM:
+                case OP_BOOL:
+                    constant->value = ip[1].op == OP_NOT_NUM ? !value : (value != 0);
+                    ip[1] = ip[0];
+                    ip[0].op = OP_NOP;
+                    changed = true;
+                    continue;
+
+                case OP_JPZ:
+                    ip[0].op = OP_NOP;
+                    ip[1].op = value ? OP_NOP : OP_JP;
+                    changed = true;
+                    continue;
+
+                case OP_JPZ_AND:
+                case OP_JPNZ_OR:
+                    if ((ip[1].op == OP_JPZ_AND) == (value == 0)) {
+                        constant->value = ip[1].op == OP_JPNZ_OR;
+                        ip[1].op = OP_JP;
+                    }
+                    else {
+                        ip[0].op = ip[1].op = OP_NOP;
+                    }
+                    changed = true;
+                    continue;
+
+                default:
+                    break;
+            }
+        }
+
+        if (index + 2 >= state->code_size || ip[1].op != ip[0].op || is_target[index + 2]) {
+            continue;
+        }
+
+        double value;
+        const Variable *right = &state->constants[ip[1].arg];
+        bool folded = ip[0].op == OP_PUSH_NUM ?
+            parse_fold_number(ip[2].op, constant->value, right->value, &value) :
+            parse_fold_datetime(ip[2].op, constant->datetime, right->datetime, &value);
+
+        if (folded) {
+            *constant = (Variable) { .type = VAR_NUMBER, .value = value };
+            ip[2] = (Instr) { .op = OP_PUSH_NUM, .arg = ip[0].arg };
+            ip[0].op = ip[1].op = OP_NOP;
+            changed = true;
+            index++;
+        }
+    }
+    return changed;
+}
+
+/**
+ * Threads jumps landing on a jump straight to where that one goes, then
+ * drops code nothing reaches and jumps to the next instruction.
+ */
+bool parse_prune(ParseState *state) {
+    bool changed = false;
+
+    for (int index = 0; index < state->code_size; index++) {
+        Instr *ip = &state->code[index];
+        if (!parse_is_jump(ip->op)) {
+            continue;
+        }
+
+        // Jumps only go forward, so this ends
+        const Instr *target = &state->code[ip->arg];
+        while (target->op == OP_JP || (target->op == ip->op && ip->op != OP_JPZ)) {
+            ip->arg = target->arg;
+            target = &state->code[ip->arg];
+            changed = true;
+        }
+    }
+
+    bool reached[MAX_CODE_SIZE + 1] = { false };
+    reached[0] = true;
+    for (int index = 0; index < state->code_size; index++) {
+        const Instr *ip = &state->code[index];
+        if (!reached[index]) {
+            continue;
+        }
+        if (parse_is_jump(ip->op)) {
+            reached[ip->arg] = true;
+        }
+        if (ip->op != OP_JP && ip->op != OP_HALT) {
+            reached[index + 1] = true;
+        }
+    }
+
+    for (int index = 0; index < state->code_size; index++) {
+        Instr *ip = &state->code[index];
+        if (!reached[index]) {
+            ip->op = OP_NOP;
+            changed = true;
+        }
+    }
+
+    for (int index = 0; index < state->code_size; index++) {
+        Instr *ip = &state->code[index];
+        if (ip->op != OP_JP) {
+            continue;
+        }
+
+        int next = index + 1;
+        while (next < ip->arg && state->code[next].op == OP_NOP) {
+            next++;
+        }
+        if (next == ip->arg) {
+            ip->op = OP_NOP;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+/**
+ * Folds constants and drops dead code until nothing changes.
+ */
+void parse_optimize(ParseState *state) {
+    bool changed = true;
+    while (changed) {
+        changed = parse_fold(state);
+        parse_compact(state);
+        changed |= parse_prune(state);
+        parse_compact(state);
+    }
+}
+
+/**
+ * The column of "'literal' in column" at index, a push, a load and the 'in',
+ * or -1. Nothing may jump in between.
+ */
+int parse_substring_var(const ParseState *state, const bool *is_target, int index) {
+    const Instr *ip = &state->code[index];
+    if (index + 3 > state->code_size || is_target[index + 1] || is_target[index + 2] ||
+        ip[0].op != OP_PUSH_STR || ip[1].op != OP_LOAD_STR || ip[2].op != OP_IN_STR) {
+        return -1;
+    }
+    return ip[1].arg;
+}
+
+/**
+ * Merges runs of "'literal' in column" on one column, or'ed to the same
+ * place, into one load and one Aho-Corasick search for all the literals.
+ * Each test but the last is followed by the '|' jump, the last one either
+ * is too or falls through to where the jumps go.
+ */
+void parse_any_substring(ParseState *state) {
+    bool is_target[MAX_CODE_SIZE + 1];
+    parse_targets(state, is_target);
+
+    for (int index = 0; index < state->code_size; index++) {
+        int var = parse_substring_var(state, is_target, index);
+        if (var < 0) {
+            continue;
+        }
+
+        // Tests, each 3 instructions and maybe a jump, from index to end
+        int count = 0;
+        int end = index;
+        int target = -1;
+        const char *patterns[MAX_CODE_SIZE / 3];
+        for (int pos = index; parse_substring_var(state, is_target, pos) == var; ) {
+            const Instr *jump = &state->code[pos + 3];
+            bool is_last = pos + 3 == target;
+            bool is_or = pos + 3 < state->code_size && jump->op == OP_JPNZ_OR &&
+                !is_target[pos + 3] && (target < 0 || jump->arg == target);
+            if (!is_or && !is_last) {
+                break;
+            }
+
+            patterns[count++] = state->constants[state->code[pos].arg].str;
+            end = is_or ? pos + 4 : pos + 3;
+            target = is_or ? jump->arg : target;
+            if (is_last || is_target[end]) {
+                break;
+            }
+            pos = end;
+        }
+        if (count < 2) {
+            continue;
+        }
+
+        // The first push becomes the automaton, the rest goes
+        Variable *constant = &state->constants[state->code[index].arg];
+        Aho *aho = aho_compile(patterns, count);
+        mem_free((void *) constant->str);
+        *constant = (Variable) { .type = VAR_AHO, .aho = aho };
+
+        bool has_jump = state->code[end - 1].op == OP_JPNZ_OR;
+        Instr *ip = &state->code[index];
+        int constant_index = ip[0].arg;
+        ip[0] = (Instr) { .op = OP_LOAD_STR, .arg = var };
+        ip[1] = (Instr) { .op = OP_IN_ANY_STR, .arg = constant_index };
+        for (int pos = index + 2; pos < end; pos++) {
+            state->code[pos].op = OP_NOP;
+        }
+        if (has_jump) {
+            state->code[end - 1] = (Instr) { .op = OP_JPNZ_OR, .arg = target };
+        }
+        index = end - 1;
+    }
+    parse_compact(state);
+}
+
+/**
+ * Peephole pass fusing "column compared with a constant", a load, a push and
+ * a compare, into one instruction that reads both operands itself. Nothing
+ * is fused across a jump target.
+ */
+void parse_peephole(ParseState *state) {
+    bool is_target[MAX_CODE_SIZE + 1];
+    parse_targets(state, is_target);
+
+    for (int index = 0; index + 2 < state->code_size; index++) {
+        Instr *ip = &state->code[index];
+        if (is_target[index + 1] || is_target[index + 2]) {
+            continue;
+        }
+
+        OpCode fused = parse_fused_compare(ip[0].op, ip[1].op, ip[2].op);
+        if (fused != OP_NOP) {
+            ip[0] = (Instr) {
+                .op = fused,
+                .arg = INSTR_PAIR(ip[0].arg, ip[1].arg)
+            };
+            ip[1].op = ip[2].op = OP_NOP;
+            index += 2;
+        }
+    }
+    parse_compact(state);
+}
+
+/**
+ * The deepest the stack gets, walking the code straight through. Both arms
+ * of a condition are counted as if they ran after each other, which only
+ * overestimates, so the VM needs no overflow check of its own.
+ */
+int parse_max_stack(ParseState *state) {
+    int depth = 0;
+    int max_depth = 0;
+    for (int index = 0; index < state->code_size; index++) {
+        depth += execute_stack_effect(state->code[index].op);
+        if (depth > max_depth) {
+            max_depth = depth;
+        }
+    }
+
+    if (max_depth > MAX_STACK_SIZE) {
+        parse_fatal(state, "Expression too deep, needs a stack of %d\n", max_depth);
+    }
+    return max_depth;
+}
+
+/**
+ * Packs the instructions and constants behind the Program header, so a
+ * filter is one small allocation the VM walks front to back.
+ */
+Program *parse_program(ParseState *state) {
+    int parsed_size = state->code_size;
+    parse_optimize(state);
+    parse_any_substring(state);
+    parse_peephole(state);
+
+    size_t code_bytes = state->code_size * sizeof(Instr);
+    size_t constant_bytes = state->constant_count * sizeof(Variable);
+
+    Program *program = (Program *) mem_malloc(sizeof(Program) + code_bytes + constant_bytes);
+    if (program == NULL) {
+        parse_fatal(state, "Out of memory\n");
+    }
+
+    Instr *code = (Instr *) (program + 1);
+    Variable *constants = (Variable *) (code + state->code_size);
+    memcpy(code, state->code, code_bytes);
+    memcpy(constants, state->constants, constant_bytes);
+
+    program->code = code;
+    program->constants = constants;
+    program->code_size = state->code_size;
+    program->constant_count = state->constant_count;
+    program->max_stack = parse_max_stack(state);
+    program->parsed_size = parsed_size;
+
+    return program;
+}
+
+const Program *parse_expression(const char *iexpr, Variable *ivariables) {
     ParseState state = {
         .expr = iexpr,
         .expr_begin = iexpr,
         .expr_end = iexpr + strlen(iexpr),
         .variables = ivariables,
-        .code = (Variable *) mem_malloc(MAX_CODE_SIZE * sizeof(Variable *)),
+        .code = (Instr *) mem_malloc(MAX_CODE_SIZE * sizeof(Instr)),
         .code_size = 0,
+        .constants = (Variable *) mem_malloc(MAX_CODE_SIZE * sizeof(Variable)),
+        .constant_count = 0,
         .op = OP_NOP,
         .type = VAR_UNKNOWN
     };
 
-    if (state.code == NULL) {
+    if (state.code == NULL || state.constants == NULL) {
         parse_fatal(&state, "Out of memory\n");
     }
 
     next_token(&state);
-    parse_expr(&state);
+    DataType data_type = parse_expr(&state);
+    if (data_type == VAR_SET) {
+        parse_fatal(&state, "file() can only be looked up with 'in'\n");
+    }
+
+    emit(&state, OP_HALT, 0);
 
-    emit(&state, OP_HALT, 0, VAR_UNKNOWN);
+    Program *program = parse_program(&state);
+    program->type = data_type;
+    mem_free(state.code);
+    mem_free(state.constants);
 
-    return state.code;
+    return program;
 }
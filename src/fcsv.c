@@ -14,21 +14,33 @@
 /**
  * This program filters CSV files
  */
+#define _GNU_SOURCE
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <sys/ioctl.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <dirent.h>
 #include <limits.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 #include "../hdr/dmalloc.h"
 #include "../hdr/conf.h"
 #include "../hdr/exec.h"
 #include "../hdr/expr.h"
+#include "../hdr/reader.h"
+#include "../hdr/buffer.h"
+#include "../hdr/arena.h"
+#include "../hdr/writer.h"
+#include "../hdr/token.h"
+#include "../hdr/number.h"
+#include "../hdr/datetime.h"
+#include "../hdr/match.h"
 
 #define COLOR_RESET     "\033[0m"
 #define COLOR_GREEN     "\033[32m"
@@ -36,56 +48,114 @@
 #define COLOR_CYAN      "\033[36m"
 
 #define MAX_VARIABLES   (1024)
-#define MAX_LINE_LENGTH (1024 * 10)
+
+#define COLUMN_BASE     (2000)
+#   define COLUMN_INT       (COLUMN_BASE + 0)
+#   define COLUMN_FLOAT     (COLUMN_BASE + 1)
+#   define COLUMN_STRING    (COLUMN_BASE + 2)
+#   define COLUMN_DATETIME  (COLUMN_BASE + 3)
+
+#define OUTPUT_FLUSH_SIZE       (1024 * 1024)
+#define PARALLEL_CHUNK_SIZE     (1024 * 1024 * 4)
+
+typedef struct {
+    Variable variables[MAX_VARIABLES];
+    Span tokens[MAX_VARIABLES];
+    Buffer unquoted;
+    Buffer row_strings;
+    Arena scratch;          // Strings the scripts make, reset every row
+} Context;
+
+typedef struct {
+    const char *input_delimiter;
+    const char *output_delimiter;
+    const Program *input_code;
+    const Program *output_code[MAX_VARIABLES];
+    int output_code_count;
+    int column_count;
+    int input_columns[MAX_VARIABLES];
+    int input_column_count;
+    int output_columns[MAX_VARIABLES];
+    int output_column_count;
+    int column_parsers[MAX_VARIABLES];
+    char *output_fields_copy;
+    char *headder;
+} Filter;
+
+// The column types declared by input_format, by position or by the names in
+// input_headder
+typedef struct {
+    int count;
+    int parsers[MAX_VARIABLES];
+    Span names[MAX_VARIABLES];
+    int name_count;
+    char *format_copy;
+    char *names_copy;
+} Schema;
+
+// A filter compiled for one header, shared by all files with that header
+typedef struct Plan {
+    uint64_t hash;
+    char *line;
+    size_t len;
+    Filter filter;
+    Context *setup;
+    struct Plan *next;
+} Plan;
+
+const struct {
+    const char *option;
+    const char *key;
+    const char *value;
+    const char *help;
+} options[] = {
+    {.option = "--threads",     .key = "threads",           .value = NULL,      .help = "<n> filter each file on n threads, plain files only"},
+    {.option = "--jobs",        .key = "jobs",              .value = NULL,      .help = "<n> process n files at the same time"},
+    {.option = "--pipeline",    .key = "pipeline",          .value = NULL,      .help = "<mb> read and write on own threads, with mb of buffers"},
+    {.option = "--gzip",        .key = "output_gzip",       .value = NULL,      .help = "<n> gzip compress the output on n threads"},
+    {.option = "--unordered",   .key = "output_unordered",  .value = "true",    .help = "write rows in completion order when threaded"},
+    {.option = "--code",        .key = "print_code",        .value = "true",    .help = "print the compiled scripts and their instruction counts"},
+    {.option = NULL,            .key = NULL,                .value = NULL,      .help = NULL},
+};
 
 int variables_base = 0;
 Variable variables[MAX_VARIABLES];
 
-const char *tokens[MAX_VARIABLES];
+Schema schema = { .count = 0, .name_count = 0, .format_copy = NULL, .names_copy = NULL };
+Plan *plans = NULL;
+pthread_mutex_t plans_lock = PTHREAD_MUTEX_INITIALIZER;
 
-int is_valid_double(const char *str) {
-    char *endptr;
-    strtod(str, &endptr);
-    return *endptr == '\0' && endptr != str;
+int is_valid_double(Span token) {
+    double value;
+    return token.len > 0 && number_parse(token.str, token.len, &value) == token.len;
 }
 
-int is_valid_iso_datetime(const char *str) {
-    struct tm datetime;
-    return strptime(str, "%Y-%m-%dT%H:%M:%S", &datetime) != NULL;
+int is_valid_iso_datetime(Span token) {
+    int64_t datetime;
+    return datetime_parse(token.str, token.len, &datetime);
 }
 
-void tokenize_line(const char *line, const char *delimiter) {
-    if (!line) {
-        tokens[0] = NULL;
-        return;
+/**
+ * Splits at most limit columns out of line. Quoted fields with escaped quotes
+ * are unescaped into scratch, or in place when scratch is NULL, for lines we
+ * own.
+ */
+int tokenize_line(Span *tokens, Span line, const char *delimiter, Buffer *scratch, int limit) {
+    if (!line.str) {
+        tokens[0].str = NULL;
+        return 0;
     }
 
-    int count = 0;
-    const char *start = line;
-    char *end;
-
-    while ((end = strstr(start, delimiter)) != NULL) {
-        if (count + 2 >= MAX_VARIABLES) {
-            fprintf(stderr, "Too many tokens\n");
-            exit(EXIT_FAILURE);
-        }
-
-        *end = '\0';
-        tokens[count++] = start;
-        start = end + strlen(delimiter);
+    if (scratch) {
+        buffer_reserve(scratch, line.len + 1);
     }
-    tokens[count++] = start;
-
-    for (int i = 0; i < count; i++) {
-        const char *token = tokens[i];
-        while (isspace((unsigned char)*token)) token++;
-        tokens[i] = token;
+    return token_split(tokens, MAX_VARIABLES, limit, line, delimiter, scratch ? scratch->data : NULL);
+}
 
-        char *end = (char *)token + strlen(token) - 1;
-        while (end > token && isspace((unsigned char)*end)) end--;
-        *(end + 1) = '\0';
+void terminate_tokens(Span *tokens) {
+    for (int i = 0; tokens[i].str != NULL; i++) {
+        ((char *) tokens[i].str)[tokens[i].len] = '\0';
     }
-    tokens[count] = NULL;
 }
 
 void var_print(const Variable *var) {
@@ -101,8 +171,8 @@ void var_print(const Variable *var) {
 
         case VAR_DATETIME:
             {
-                char buffer[20];
-                strftime(buffer, sizeof(buffer), DATE_FORMAT, &var->datetime);
+                char buffer[DATETIME_SIZE];
+                datetime_format(var->datetime, buffer);
                 printf("%s\n", buffer);
             }
             break;
@@ -130,7 +200,7 @@ void var_free(Variable *var) {
     }
 }
 
-void var_cleaning(bool all) {
+void var_cleaning(Variable *variables, bool all) {
     if (all) {
         for (int idx = 0; idx < variables_base; idx++) {
             var_free(&variables[idx]);
@@ -151,6 +221,15 @@ const char *var_get_str(const char *name, const char *default_value) {
     return default_value;
 }
 
+double var_get_num(const char *name, double default_value) {
+    for (int i = 0; variables[i].type != VAR_END; i++) {
+        if (strcmp(variables[i].name, name) == 0 && variables[i].type == VAR_NUMBER) {
+            return variables[i].value;
+        }
+    }
+    return default_value;
+}
+
 void assign_variables_config(Config *config) {
     int idx = 0;
     while (idx < config->count) {
@@ -170,14 +249,17 @@ void assign_variables_config(Config *config) {
             var->type = VAR_STRING;
             var->str = expr;
             var->is_dynamic = false;
+            var->is_constant = true;
         }
         else {
-            const Variable *code = parse_expression(expr, variables);
-            Variable exec_var = execute_code_datatype(code, variables);
+            Arena scratch = { .first = NULL, .current = NULL };
+            const Program *code = parse_expression(expr, variables);
+            Variable exec_var = execute_code_datatype(code, variables, &scratch);
 
             var->name = name;
             var->type = exec_var.type;
             var->is_dynamic = false;
+            var->is_constant = true;
 
             switch (exec_var.type) {
                 case VAR_NUMBER:
@@ -192,13 +274,10 @@ void assign_variables_config(Config *config) {
                         exit(EXIT_FAILURE);
                     }
                     strcpy((char *)var->str, (char *)exec_var.str);
-                    if (exec_var.is_dynamic) {
-                        mem_free((void *) exec_var.str);
-                    }
                     break;
 
                 case VAR_DATETIME:
-                    var->datetime = exec_var.datetime; // FIXME: Copy??
+                    var->datetime = exec_var.datetime;
                     break;
 
                 default:
@@ -207,6 +286,7 @@ void assign_variables_config(Config *config) {
             }
 
             parse_cleaning(code);
+            arena_free(&scratch);
         }
 
         idx ++;
@@ -216,69 +296,509 @@ void assign_variables_config(Config *config) {
     variables[variables_base].type = VAR_END;
 }
 
-void assign_variables_name() {
+Context *context_create() {
+    Context *ctx = (Context *) mem_malloc(sizeof(Context));
+    if (ctx == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(ctx->variables, variables, (variables_base + 1) * sizeof(Variable));
+    ctx->tokens[0].str = NULL;
+    ctx->unquoted = (Buffer) { .data = NULL, .len = 0, .size = 0 };
+    ctx->row_strings = (Buffer) { .data = NULL, .len = 0, .size = 0 };
+    ctx->scratch = (Arena) { .first = NULL, .current = NULL };
+
+    return ctx;
+}
+
+void context_copy_columns(Context *ctx, const Context *source) {
+    int count = variables_base;
+    while (source->variables[count].type != VAR_END) count++;
+    memcpy(ctx->variables, source->variables, (count + 1) * sizeof(Variable));
+}
+
+/**
+ * Workers get their own copy of the variable table, so the column names and
+ * types are shared read-only while the row values stay private.
+ */
+Context *context_clone(const Context *source) {
+    Context *ctx = context_create();
+    context_copy_columns(ctx, source);
+
+    return ctx;
+}
+
+void context_free(Context *ctx) {
+    var_cleaning(ctx->variables, false);
+    buffer_free(&ctx->unquoted);
+    buffer_free(&ctx->row_strings);
+    arena_free(&ctx->scratch);
+    mem_free(ctx);
+}
+
+void assign_variables_name(Context *ctx) {
     int idx = 0;
-    while (tokens[idx] != NULL) {
+    while (ctx->tokens[idx].str != NULL) {
         if (variables_base + idx + 2 >= MAX_VARIABLES) {
             fprintf(stderr, "Too many variables\n");
             exit(EXIT_FAILURE);
         }
 
-        Variable *var = &variables[variables_base + idx];
-        var->name = tokens[idx];
+        Variable *var = &ctx->variables[variables_base + idx];
+        var->name = ctx->tokens[idx].str;
         var->type = VAR_UNKNOWN;
         var->is_dynamic = false;
+        var->is_constant = false;
 
         idx ++;
     }
-    variables[variables_base + idx].type = VAR_END;
+    ctx->variables[variables_base + idx].type = VAR_END;
 }
 
-void assign_variables_type() {
-    for (int idx = 0; tokens[idx] != NULL; idx++) {
-        Variable *var = &variables[variables_base + idx];
+/**
+ * Without an input_format the column types are guessed from the first row.
+ */
+void assign_variables_type(Filter *filter, Context *ctx, Span line) {
+    tokenize_line(ctx->tokens, line, filter->input_delimiter, &ctx->unquoted, MAX_VARIABLES);
+
+    for (int idx = 0; ctx->tokens[idx].str != NULL; idx++) {
+        Variable *var = &ctx->variables[variables_base + idx];
         var->is_dynamic = false;
 
-        if (is_valid_double(tokens[idx])) {
+        if (is_valid_double(ctx->tokens[idx])) {
             var->type = VAR_NUMBER;
+            filter->column_parsers[idx] = COLUMN_FLOAT;
         }
-        else if (is_valid_iso_datetime(tokens[idx])) {
+        else if (is_valid_iso_datetime(ctx->tokens[idx])) {
             var->type = VAR_DATETIME;
+            filter->column_parsers[idx] = COLUMN_DATETIME;
         }
         else {
             var->type = VAR_STRING;
+            filter->column_parsers[idx] = COLUMN_STRING;
+        }
+    }
+}
+
+/**
+ * Types the header columns from the input_format schema, with no look at the
+ * data. Columns the schema doesn't cover are strings.
+ */
+void assign_variables_schema(Filter *filter, Context *ctx) {
+    for (int idx = 0; ctx->variables[variables_base + idx].type != VAR_END; idx++) {
+        Variable *var = &ctx->variables[variables_base + idx];
+        var->is_dynamic = false;
+
+        int parser = COLUMN_STRING;
+        if (schema.name_count > 0) {
+            size_t len = strlen(var->name);
+            for (int index = 0; index < schema.name_count; index++) {
+                if (schema.names[index].len == len && memcmp(schema.names[index].str, var->name, len) == 0) {
+                    parser = schema.parsers[index];
+                    break;
+                }
+            }
+        }
+        else if (idx < schema.count) {
+            parser = schema.parsers[idx];
+        }
+
+        filter->column_parsers[idx] = parser;
+        switch (parser) {
+            case COLUMN_INT:
+            case COLUMN_FLOAT:
+                var->type = VAR_NUMBER;
+                break;
+
+            case COLUMN_DATETIME:
+                var->type = VAR_DATETIME;
+                break;
+
+            default:
+                var->type = VAR_STRING;
+                break;
         }
     }
 }
 
-void assign_variables_value() {
-    var_cleaning(false);
+/**
+ * Converts the listed columns of the tokenized row with their column parsers.
+ * Strings are copied to row_strings, behind the ones already converted for
+ * this row.
+ */
+void assign_variables_value(Context *ctx, int token_count, const int *parsers, const int *columns, int column_count) {
+    char *row_str = ctx->row_strings.data + ctx->row_strings.len;
 
-    for (int idx = 0; tokens[idx] != NULL; idx++) {
-        Variable *var = &variables[variables_base + idx];
+    for (int index = 0; index < column_count; index++) {
+        int idx = columns[index];
+        Variable *var = &ctx->variables[variables_base + idx];
         var->is_dynamic = false;
-        switch (var->type) {
+
+        // Short rows leave the missing columns empty, not holding the previous row
+        if (idx >= token_count) {
+            if (var->type == VAR_STRING) {
+                var->str = "";
+            }
+            else {
+                var->datetime = 0;
+            }
+            continue;
+        }
+
+        const Span *token = &ctx->tokens[idx];
+        switch (parsers[idx]) {
+            case COLUMN_INT:
+                number_parse_int(token->str, token->len, &var->value);
+                break;
+
+            case COLUMN_FLOAT:
+                number_parse(token->str, token->len, &var->value);
+                break;
+
+            case COLUMN_STRING:
+                memcpy(row_str, token->str, token->len);
+                row_str[token->len] = '\0';
+                var->str = row_str;
+                row_str += token->len + 1;
+                break;
+
+            case COLUMN_DATETIME:
+                if (!datetime_parse(token->str, token->len, &var->datetime)) {
+                    var->datetime = 0;
+                }
+                break;
+
+            default:
+                fprintf(stderr, "Unknown variable type %d!?\n", var->type);
+                exit(EXIT_FAILURE);
+                break;
+        }
+    }
+
+    ctx->row_strings.len = row_str - ctx->row_strings.data;
+}
+
+void filter_init(Filter *filter) {
+    filter->input_delimiter = var_get_str("input_csv_delimiter", ",");
+    filter->output_delimiter = NULL;
+    filter->input_code = NULL;
+    filter->output_code_count = 0;
+    filter->column_count = 0;
+    filter->input_column_count = 0;
+    filter->output_column_count = 0;
+    filter->output_fields_copy = NULL;
+    filter->headder = NULL;
+}
+
+void filter_output_headder(Span line, Buffer *output) {
+    const char *output_headder = var_get_str("output_headder", NULL);
+    if (output_headder) {
+        buffer_append(output, output_headder, strlen(output_headder));
+        buffer_append(output, "\n", strlen("\n"));
+    }
+    else {
+        buffer_append(output, line.str, line.len);
+    }
+}
+
+void filter_headder(Filter *filter, Context *ctx, Span line) {
+    filter->headder = (char *) mem_malloc(line.len + 1);
+    if (filter->headder == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(filter->headder, line.str, line.len);
+    filter->headder[line.len] = '\0';
+
+    tokenize_line(ctx->tokens, (Span) { .str = filter->headder, .len = line.len }, filter->input_delimiter, NULL, MAX_VARIABLES);
+    terminate_tokens(ctx->tokens);
+    assign_variables_name(ctx);
+}
+
+void filter_compile(Filter *filter, Context *ctx, const char *expr) {
+    filter->input_code = parse_expression(expr, ctx->variables);
+
+    const char *output_fields = var_get_str("output_fields_script", NULL);
+    if (output_fields) {
+        filter->output_fields_copy = (char *) mem_malloc(strlen(output_fields) + 1);
+        if (filter->output_fields_copy == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        strcpy(filter->output_fields_copy, output_fields);
+
+        filter->output_delimiter = var_get_str("output_csv_delimiter", filter->input_delimiter);
+
+        Span fields = { .str = filter->output_fields_copy, .len = strlen(output_fields) };
+        tokenize_line(ctx->tokens, fields, filter->output_delimiter, NULL, MAX_VARIABLES);
+        terminate_tokens(ctx->tokens);
+
+        filter->output_code_count = 0;
+        for (int index = 0; ctx->tokens[index].str != NULL; index++) {
+            filter->output_code[filter->output_code_count++] = parse_expression(ctx->tokens[index].str, ctx->variables);
+        }
+    }
+
+    // The instruction counts are the dispatches per row, for code without
+    // conditions
+    if (var_get_num("print_code", 0) != 0) {
+        fprintf(stderr, "input_script: ");
+        execute_print_code(stderr, filter->input_code, ctx->variables);
+        for (int index = 0; index < filter->output_code_count; index++) {
+            fprintf(stderr, "output_fields_script %d: ", index + 1);
+            execute_print_code(stderr, filter->output_code[index], ctx->variables);
+        }
+    }
+
+    // Only the columns the scripts read are converted, the input script's
+    // before filtering and the rest for rows that pass. Rows are only split
+    // up to the last of them, a full row is written as is.
+    bool input_used[MAX_VARIABLES] = { false };
+    bool output_used[MAX_VARIABLES] = { false };
+    parse_used_variables(filter->input_code, input_used, MAX_VARIABLES);
+    for (int index = 0; index < filter->output_code_count; index++) {
+        parse_used_variables(filter->output_code[index], output_used, MAX_VARIABLES);
+    }
+
+    filter->column_count = 0;
+    filter->input_column_count = 0;
+    filter->output_column_count = 0;
+    for (int idx = 0; ctx->variables[variables_base + idx].type != VAR_END; idx++) {
+        if (input_used[variables_base + idx]) {
+            filter->input_columns[filter->input_column_count++] = idx;
+        }
+        else if (output_used[variables_base + idx]) {
+            filter->output_columns[filter->output_column_count++] = idx;
+        }
+        else {
+            continue;
+        }
+        filter->column_count = idx + 1;
+    }
+}
+
+void filter_cleaning(Filter *filter) {
+    for (int index = 0; index < filter->output_code_count; index++) {
+        parse_cleaning(filter->output_code[index]);
+    }
+    parse_cleaning(filter->input_code);
+
+    mem_free(filter->output_fields_copy);
+    mem_free(filter->headder);
+}
+
+char *schema_split(const char *str, Span *spans, int *count) {
+    char *copy = (char *) mem_malloc(strlen(str) + 1);
+    if (copy == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    strcpy(copy, str);
+
+    *count = tokenize_line(spans, (Span) { .str = copy, .len = strlen(copy) }, ",", NULL, MAX_VARIABLES);
+    for (int index = 0; index < *count; index++) {
+        spans[index] = span_trim(spans[index]);
+    }
+    return copy;
+}
+
+/**
+ * Reads input_format, like "%d,%s,%f,%t", and the optional input_headder
+ * naming its columns. Columns are int (%d), float (%f), string (%s) or
+ * datetime (%t).
+ */
+void schema_init() {
+    const char *format = var_get_str("input_format", NULL);
+    if (format == NULL) {
+        return;
+    }
+
+    Span formats[MAX_VARIABLES];
+    schema.format_copy = schema_split(format, formats, &schema.count);
+
+    for (int index = 0; index < schema.count; index++) {
+        Span field = formats[index];
+        char type = (field.len == 2 && field.str[0] == '%') ? field.str[1] : '\0';
+        switch (type) {
+            case 'd':
+                schema.parsers[index] = COLUMN_INT;
+                break;
+
+            case 'f':
+                schema.parsers[index] = COLUMN_FLOAT;
+                break;
+
+            case 's':
+                schema.parsers[index] = COLUMN_STRING;
+                break;
+
+            case 't':
+                schema.parsers[index] = COLUMN_DATETIME;
+                break;
+
+            default:
+                fprintf(stderr, "Error: Unknown input_format '%.*s', use %%d, %%f, %%s or %%t\n", (int) field.len, field.str);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    const char *headder = var_get_str("input_headder", NULL);
+    if (headder != NULL) {
+        schema.names_copy = schema_split(headder, schema.names, &schema.name_count);
+        if (schema.name_count != schema.count) {
+            fprintf(stderr, "Error: input_headder has %d columns, input_format %d\n", schema.name_count, schema.count);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+void schema_cleaning() {
+    mem_free(schema.format_copy);
+    mem_free(schema.names_copy);
+}
+
+/**
+ * FNV-1a of the header line.
+ */
+uint64_t plan_hash(Span line) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t index = 0; index < line.len; index++) {
+        hash = (hash ^ (unsigned char) line.str[index]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/**
+ * Returns the filter compiled for this header line, compiling it on first
+ * use. With a schema nothing depends on the rows, so every file with the
+ * same header, on any job thread, reuses it.
+ */
+const Plan *plan_get(Span line, const char *expr) {
+    uint64_t hash = plan_hash(line);
+
+    pthread_mutex_lock(&plans_lock);
+    Plan *plan = plans;
+    while (plan != NULL && (plan->hash != hash || plan->len != line.len || memcmp(plan->line, line.str, line.len) != 0)) {
+        plan = plan->next;
+    }
+
+    if (plan == NULL) {
+        plan = (Plan *) mem_malloc(sizeof(Plan));
+        char *copy = (char *) mem_malloc(line.len + 1);
+        if (plan == NULL || copy == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(copy, line.str, line.len);
+
+        plan->hash = hash;
+        plan->line = copy;
+        plan->len = line.len;
+        plan->setup = context_create();
+        filter_init(&plan->filter);
+        filter_headder(&plan->filter, plan->setup, line);
+        assign_variables_schema(&plan->filter, plan->setup);
+        filter_compile(&plan->filter, plan->setup, expr);
+
+        plan->next = plans;
+        plans = plan;
+    }
+    pthread_mutex_unlock(&plans_lock);
+
+    return plan;
+}
+
+void plan_cleaning() {
+    while (plans != NULL) {
+        Plan *plan = plans;
+        plans = plan->next;
+
+        filter_cleaning(&plan->filter);
+        context_free(plan->setup);
+        mem_free(plan->line);
+        mem_free(plan);
+    }
+}
+
+/**
+ * Appends str as a CSV field, quoted when it holds the delimiter, a quote or
+ * a newline.
+ */
+void output_append_str(Buffer *output, const char *str, const char *delimiter) {
+    if (strpbrk(str, "\"\r\n") == NULL && strstr(str, delimiter) == NULL) {
+        buffer_append(output, str, strlen(str));
+        return;
+    }
+
+    buffer_append(output, "\"", 1);
+    for (const char *quote; (quote = strchr(str, '"')) != NULL; str = quote + 1) {
+        buffer_append(output, str, quote - str + 1);
+        buffer_append(output, "\"", 1);
+    }
+    buffer_append(output, str, strlen(str));
+    buffer_append(output, "\"", 1);
+}
+
+/**
+ * Runs one data row through the filter and appends the projected row, or the
+ * row itself, to output. Returns true when the row was written.
+ */
+bool filter_line(const Filter *filter, Context *ctx, Span line, Buffer *output) {
+    int token_count = tokenize_line(ctx->tokens, line, filter->input_delimiter, &ctx->unquoted, filter->column_count);
+
+    ctx->row_strings.len = 0;
+    buffer_reserve(&ctx->row_strings, line.len + 1);
+    arena_reset(&ctx->scratch);
+    assign_variables_value(ctx, token_count, filter->column_parsers, filter->input_columns, filter->input_column_count);
+
+    bool is_true = execute_code(filter->input_code, ctx->variables, &ctx->scratch) != 0;
+    if (!is_true) return false;
+
+    if (!filter->output_code_count) {
+        buffer_append(output, line.str, line.len);
+        return true;
+    }
+    assign_variables_value(ctx, token_count, filter->column_parsers, filter->output_columns, filter->output_column_count);
+
+    for (int index = 0; index < filter->output_code_count; index++) {
+        const Variable res = execute_code_datatype(filter->output_code[index], ctx->variables, &ctx->scratch);
+        switch (res.type) {
             case VAR_NUMBER:
-                var->value = atof(tokens[idx]);
+                buffer_printf(output, "%f", res.value);
                 break;
 
             case VAR_STRING:
-                var->str = tokens[idx];
+                output_append_str(output, res.str, filter->output_delimiter);
                 break;
 
             case VAR_DATETIME:
-                strptime(tokens[idx], DATE_FORMAT, &var->datetime);
+                {
+                    char buffer[DATETIME_SIZE];
+                    datetime_format(res.datetime, buffer);
+                    buffer_append(output, buffer, DATETIME_LEN);
+                }
                 break;
 
             default:
-                fprintf(stderr, "Unknown variable type %d!?\n", var->type);
+                fprintf(stderr, "Unknown variable type %d!\n", res.type);
                 exit(EXIT_FAILURE);
-                break;
+        }
+
+        if (index < filter->output_code_count - 1) {
+            buffer_append(output, filter->output_delimiter, strlen(filter->output_delimiter));
         }
     }
+    buffer_append(output, "\n", strlen("\n"));
+
+    return true;
 }
 
 void  update_progress_bar(long processed_size, long file_size, long *last_progress) {
+    if (file_size <= 0) {
+        return;
+    }
+
     int progress = (int)((processed_size * 100) / file_size);
     if (progress > 100) progress = 100;
 
@@ -300,168 +820,602 @@ void  update_progress_bar(long processed_size, long file_size, long *last_progre
     fflush(stdout);
 }
 
+
+typedef struct {
+    size_t start;
+    size_t end;
+    Buffer output;
+    int total_lines;
+    int written_lines;
+    bool done;
+} Chunk;
+
+typedef struct {
+    const Filter *filter;
+    const Context *setup;
+    const char *data;
+    Writer *writer;
+    bool unordered;
+
+    size_t *bounds;
+    int chunk_count;
+    int next_chunk;
+    int written_chunk;
+
+    Chunk *slots;
+    int slot_count;
+
+    int total_lines;
+    int written_lines;
+
+    // Drawn by the workers under write_lock when unordered
+    long progress_size;
+    long processed_size;
+    long last_progress;
+
+    pthread_mutex_t lock;
+    pthread_mutex_t write_lock;
+    pthread_cond_t chunk_done;
+    pthread_cond_t slot_free;
+} Parallel;
+
+typedef struct {
+    const char *data;
+    const size_t *grid;
+    bool *odd;
+    int count;
+    int first;
+    int step;
+} QuoteScan;
+
+void *quote_scan_worker(void *arg) {
+    QuoteScan *scan = (QuoteScan *) arg;
+
+    for (int index = scan->first; index < scan->count; index += scan->step) {
+        scan->odd[index] = reader_quote_parity(scan->data + scan->grid[index], scan->data + scan->grid[index + 1]);
+    }
+
+    return NULL;
+}
+
+/**
+ * Counts the quotes of every grid range on threads. The quote state at a grid
+ * point is then the parity of all the ranges before it.
+ */
+void quote_scan(const char *data, const size_t *grid, bool *odd, int count, int threads) {
+    if (count == 0) {
+        return;
+    }
+    if (threads > count) {
+        threads = count;
+    }
+
+    QuoteScan *scans = (QuoteScan *) mem_malloc(threads * sizeof(QuoteScan));
+    pthread_t *workers = (pthread_t *) mem_malloc(threads * sizeof(pthread_t));
+    if (scans == NULL || workers == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int index = 0; index < threads; index++) {
+        scans[index] = (QuoteScan) {
+            .data = data,
+            .grid = grid,
+            .odd = odd,
+            .count = count,
+            .first = index,
+            .step = threads
+        };
+        if (pthread_create(&workers[index], NULL, quote_scan_worker, &scans[index]) != 0) {
+            fprintf(stderr, "Error: Can't start worker thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (int index = 0; index < threads; index++) {
+        pthread_join(workers[index], NULL);
+    }
+
+    mem_free(workers);
+    mem_free(scans);
+}
+
+/**
+ * Splits the complete rows of [start, end) into byte ranges of roughly
+ * PARALLEL_CHUNK_SIZE, each moved forward so it begins right after a row end.
+ * Newlines inside quotes are no row ends, so the quote state at every grid
+ * point comes from quote_scan. A last row without newline is left out.
+ */
+int parallel_split(Parallel *par, size_t start, size_t end, int threads) {
+    int grid_count = (end - start) / PARALLEL_CHUNK_SIZE + 1;
+    size_t *grid = (size_t *) mem_malloc((grid_count + 1) * sizeof(size_t));
+    bool *odd = (bool *) mem_malloc(grid_count * sizeof(bool));
+    par->bounds = (size_t *) mem_malloc((grid_count + 1) * sizeof(size_t));
+    if (grid == NULL || odd == NULL || par->bounds == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Grid points sit one byte early, so a newline right before the chunk
+    // size is found too
+    grid[0] = start;
+    for (int index = 1; index < grid_count; index++) {
+        grid[index] = start + (size_t) index * PARALLEL_CHUNK_SIZE - 1;
+    }
+    grid[grid_count] = end;
+    quote_scan(par->data, grid, odd, grid_count - 1, threads);
+
+    int count = 0;
+    bool quoted = false;
+    par->bounds[0] = start;
+    for (int index = 1; index < grid_count; index++) {
+        quoted ^= odd[index - 1];
+
+        bool row_quoted = quoted;
+        const char *row_end = reader_row_end(par->data + grid[index], par->data + end, &row_quoted);
+        if (row_end == NULL) {
+            break;
+        }
+
+        size_t bound = row_end - par->data + 1;
+        if (bound > par->bounds[count]) {
+            par->bounds[++count] = bound;
+        }
+    }
+
+    bool row_quoted = false;
+    const char *pos = par->data + par->bounds[count];
+    const char *row_end;
+    while ((row_end = reader_row_end(pos, par->data + end, &row_quoted)) != NULL) {
+        pos = row_end + 1;
+    }
+    if (pos > par->data + par->bounds[count]) {
+        par->bounds[++count] = pos - par->data;
+    }
+
+    mem_free(odd);
+    mem_free(grid);
+
+    return count;
+}
+
+void parallel_chunk(Parallel *par, Context *ctx, Chunk *chunk) {
+    const char *pos = par->data + chunk->start;
+    const char *end = par->data + chunk->end;
+
+    while (pos < end) {
+        bool quoted = false;
+        const char *newline = reader_row_end(pos, end, &quoted);
+        Span line = { .str = pos, .len = newline ? (size_t) (newline - pos) + 1 : (size_t) (end - pos) };
+
+        chunk->total_lines ++;
+        if (filter_line(par->filter, ctx, line, &chunk->output)) {
+            chunk->written_lines ++;
+        }
+
+        pos += line.len;
+    }
+}
+
+void *parallel_worker(void *arg) {
+    Parallel *par = (Parallel *) arg;
+    Context *ctx = context_clone(par->setup);
+    Chunk own = { .output = { .data = NULL, .len = 0, .size = 0 } };
+
+    pthread_mutex_lock(&par->lock);
+    while (par->next_chunk < par->chunk_count) {
+        int index = par->next_chunk;
+        if (!par->unordered && index >= par->written_chunk + par->slot_count) {
+            pthread_cond_wait(&par->slot_free, &par->lock);
+            continue;
+        }
+        par->next_chunk ++;
+        pthread_mutex_unlock(&par->lock);
+
+        Chunk *chunk = par->unordered ? &own : &par->slots[index % par->slot_count];
+        chunk->start = par->bounds[index];
+        chunk->end = par->bounds[index + 1];
+        parallel_chunk(par, ctx, chunk);
+
+        if (par->unordered) {
+            pthread_mutex_lock(&par->write_lock);
+            writer_write(par->writer, &chunk->output);
+            par->total_lines += chunk->total_lines;
+            par->written_lines += chunk->written_lines;
+            par->processed_size += chunk->end - chunk->start;
+            update_progress_bar(par->processed_size, par->progress_size, &par->last_progress);
+            pthread_mutex_unlock(&par->write_lock);
+
+            chunk->total_lines = 0;
+            chunk->written_lines = 0;
+        }
+
+        pthread_mutex_lock(&par->lock);
+        if (!par->unordered) {
+            chunk->done = true;
+            pthread_cond_broadcast(&par->chunk_done);
+        }
+    }
+    pthread_mutex_unlock(&par->lock);
+
+    buffer_free(&own.output);
+    context_free(ctx);
+
+    return NULL;
+}
+
+/**
+ * Filters the mapped rows from reader->pos on over a pool of worker threads.
+ * Chunk outputs are written back in input order, unless output_unordered is
+ * set, in which case each worker writes its chunk as soon as it is done. A
+ * last row without newline is left in the reader for the caller.
+ */
+void process_csv_parallel(const Filter *filter, const Context *setup, Reader *reader, int threads, long progress_size, Writer *writer, int *total_lines, int *written_lines) {
+    Parallel par = {
+        .filter = filter,
+        .setup = setup,
+        .data = reader->data,
+        .writer = writer,
+        .unordered = var_get_num("output_unordered", 0) != 0,
+        .next_chunk = 0,
+        .written_chunk = 0,
+        .slot_count = threads * 2,
+        .total_lines = 0,
+        .written_lines = 0,
+        .progress_size = progress_size,
+        .processed_size = reader->pos,
+        .last_progress = -1
+    };
+    par.chunk_count = parallel_split(&par, reader->pos, reader->size, threads);
+    if (par.chunk_count == 0) {
+        mem_free(par.bounds);
+        return;
+    }
+
+    par.slots = (Chunk *) mem_malloc(par.slot_count * sizeof(Chunk));
+    pthread_t *workers = (pthread_t *) mem_malloc(threads * sizeof(pthread_t));
+    if (par.slots == NULL || workers == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int index = 0; index < par.slot_count; index++) {
+        par.slots[index] = (Chunk) { .output = { .data = NULL, .len = 0, .size = 0 }, .done = false };
+    }
+
+    pthread_mutex_init(&par.lock, NULL);
+    pthread_mutex_init(&par.write_lock, NULL);
+    pthread_cond_init(&par.chunk_done, NULL);
+    pthread_cond_init(&par.slot_free, NULL);
+
+    for (int index = 0; index < threads; index++) {
+        if (pthread_create(&workers[index], NULL, parallel_worker, &par) != 0) {
+            fprintf(stderr, "Error: Can't start worker thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (!par.unordered) {
+        long last_progress = -1;
+        for (int index = 0; index < par.chunk_count; index++) {
+            Chunk *chunk = &par.slots[index % par.slot_count];
+
+            pthread_mutex_lock(&par.lock);
+            while (!chunk->done) {
+                pthread_cond_wait(&par.chunk_done, &par.lock);
+            }
+            pthread_mutex_unlock(&par.lock);
+
+            writer_write(writer, &chunk->output);
+            par.total_lines += chunk->total_lines;
+            par.written_lines += chunk->written_lines;
+            update_progress_bar(par.bounds[index + 1], progress_size, &last_progress);
+
+            chunk->total_lines = 0;
+            chunk->written_lines = 0;
+
+            pthread_mutex_lock(&par.lock);
+            chunk->done = false;
+            par.written_chunk ++;
+            pthread_cond_broadcast(&par.slot_free);
+            pthread_mutex_unlock(&par.lock);
+        }
+    }
+
+    for (int index = 0; index < threads; index++) {
+        pthread_join(workers[index], NULL);
+    }
+
+    *total_lines += par.total_lines;
+    *written_lines += par.written_lines;
+    reader->pos = par.bounds[par.chunk_count];
+
+    pthread_mutex_destroy(&par.lock);
+    pthread_mutex_destroy(&par.write_lock);
+    pthread_cond_destroy(&par.chunk_done);
+    pthread_cond_destroy(&par.slot_free);
+
+    for (int index = 0; index < par.slot_count; index++) {
+        buffer_free(&par.slots[index].output);
+    }
+    mem_free(par.slots);
+    mem_free(par.bounds);
+    mem_free(workers);
+}
+
 void process_csv(const char *input_filename, const char *output_filename, const char *expr) {
     int total_lines = 0;
     int written_lines = 0;
     long last_progress = -1;
     long processed_size = 0;
+    int threads = (int) var_get_num("threads", 1);
 
-    const Variable *input_code = NULL; 
-    int output_code_count = 0;
-    const Variable *output_code[MAX_VARIABLES];
-    const char *output_delimiter = NULL;
-    char line[MAX_LINE_LENGTH];
+    // The pipeline budget in MB is split evenly over 1 MB read and write blocks
+    int pipeline_blocks = (int) var_get_num("pipeline", 0) / 2;
 
-    const char *input_csv_delimiter = var_get_str("input_csv_delimiter", ",");
+    Filter local_filter;
+    filter_init(&local_filter);
+    const Filter *filter = &local_filter;
+    Buffer output = { .data = NULL, .len = 0, .size = 0 };
+    Span line;
 
-    FILE *inputFile = fopen(input_filename, "rb");
-    if (inputFile == NULL) {
+    // Threads work on the mapping, so a file is only streamed through the
+    // pipeline when it is filtered serially. Pipes and gzip always stream.
+    Reader reader;
+    if (!reader_open(&reader, input_filename, threads > 1 || pipeline_blocks == 0, pipeline_blocks)) {
         fprintf(stderr, "Error opening input file: '%s'\n", input_filename);
         exit(EXIT_FAILURE);
     }
+    reader.quotes = true;
 
-    FILE *outputFile = fopen(output_filename, "wb");
-    if (outputFile == NULL) {
+    Writer writer;
+    if (!writer_open(&writer, output_filename, pipeline_blocks, (int) var_get_num("output_gzip", 0))) {
         fprintf(stderr, "Error creating output file: '%s'\n", output_filename);
         exit(EXIT_FAILURE);
     }
 
-    printf(COLOR_CYAN "Processing %s\n" COLOR_RESET, input_filename);
+    // With the rows going to stdout, status goes to stderr and there's no
+    // progress bar. Concurrent files would draw over each other's bar too.
+    bool to_stdout = strcmp(output_filename, "-") == 0;
+    FILE *status = to_stdout ? stderr : stdout;
+    long file_size = (to_stdout || var_get_num("jobs", 1) > 1) ? 0 : reader_size(&reader);
 
-    fseek(inputFile, 0, SEEK_END);
-    long file_size = ftell(inputFile);
-    fseek(inputFile, 0, SEEK_SET);
+    fprintf(status, COLOR_CYAN "Processing %s\n" COLOR_RESET, input_filename);
+    if (threads > 1 && reader.data == NULL) {
+        fprintf(status, "Input is streamed, not mapped, filtering on one thread\n");
+    }
+    Context *ctx = context_create();
 
-    char *output_fields_copy = NULL;
-    const char *output_fields = var_get_str("output_fields_script", NULL);
-    if (output_fields) {
-        output_fields_copy = (void *) mem_malloc(strlen(output_fields) + 1);
-        if (output_fields_copy == NULL) {
-            fprintf(stderr, "Out of memory\n");
-            exit(EXIT_FAILURE);
-        }
+    if (reader_next_line(&reader, &line)) {
+        total_lines ++;
+        processed_size += line.len;
+        filter_output_headder(line, &output);
 
-        strcpy(output_fields_copy, output_fields);      
+        if (schema.count > 0) {
+            const Plan *plan = plan_get(line, expr);
+            filter = &plan->filter;
+            context_copy_columns(ctx, plan->setup);
+        }
+        else {
+            filter_headder(&local_filter, ctx, line);
+        }
     }
 
-    while (fgets(line, sizeof(line), inputFile) != NULL) {
-        if (strlen(line) == sizeof(line) - 1) {
-            fprintf(stderr, "Error: Line too long\n");
-            exit(EXIT_FAILURE);
+    bool has_line = reader_next_line(&reader, &line);
+    if (has_line) {
+        if (schema.count == 0) {
+            assign_variables_type(&local_filter, ctx, line);
+            filter_compile(&local_filter, ctx, expr);
         }
 
+        // An unterminated last line is a copy in reader.tail, not in the mapping
+        bool mapped = reader.data && line.str >= reader.data && line.str < reader.data + reader.size;
+        if (threads > 1 && mapped) {
+            writer_write(&writer, &output);
+
+            reader.pos = line.str - reader.data;
+            process_csv_parallel(filter, ctx, &reader, threads, file_size, &writer, &total_lines, &written_lines);
+            processed_size = reader.pos;
+
+            has_line = reader_next_line(&reader, &line);
+        }
+    }
+
+    while (has_line) {
         total_lines ++;
-        processed_size += strlen(line);
+        processed_size += line.len;
         update_progress_bar(processed_size, file_size, &last_progress);
 
-        if (total_lines == 1) {
-            char headder[MAX_LINE_LENGTH];
-            strcpy(headder, line);
+        if (filter_line(filter, ctx, line, &output)) {
+            written_lines ++;
+        }
 
-            const char *output_headder = var_get_str("output_headder", NULL);
-            if (output_headder) {
-                fwrite(output_headder, sizeof(char), strlen(output_headder), outputFile);
-                fwrite("\n", sizeof(char), strlen("\n"), outputFile);
-            }
-            else {
-                fwrite(headder, sizeof(char), strlen(headder), outputFile);
-            }
-            processed_size += strlen(headder);
-        
-            tokenize_line(headder, input_csv_delimiter);
-            assign_variables_name();
-            continue;
+        if (output.len >= OUTPUT_FLUSH_SIZE) {
+            writer_write(&writer, &output);
         }
 
-        char copy_line[MAX_LINE_LENGTH];
-        strcpy(copy_line, line);
-        tokenize_line(line, input_csv_delimiter);
+        has_line = reader_next_line(&reader, &line);
+    }
+    writer_write(&writer, &output);
+
+    double pct_written = (double)written_lines * 100 / total_lines;
+    fprintf(status,
+        COLOR_YELLOW "\nWritten %s: %d of %d lines written (%.1f%%)\n" COLOR_RESET, 
+        output_filename, written_lines, total_lines, pct_written
+    );
 
-        if (total_lines == 2) {
-            assign_variables_type();
-            assign_variables_value();
+    reader_close(&reader);
+    writer_close(&writer);
 
-            input_code = parse_expression(expr, variables);
+    filter_cleaning(&local_filter);
+    context_free(ctx);
+    buffer_free(&output);
+}
 
-            if (output_fields_copy) {
-                output_delimiter = var_get_str("output_csv_delimiter", input_csv_delimiter);
+typedef struct {
+    char *input_filename;
+    char *output_filename;
+    long size;
+} CsvFile;
+
+typedef struct {
+    CsvFile *files;
+    int count;
+    int next;
+    const char *expr;
+    pthread_mutex_t lock;
+} FilePool;
+
+int csv_file_compare(const void *a, const void *b) {
+    const CsvFile *file_a = (const CsvFile *) a;
+    const CsvFile *file_b = (const CsvFile *) b;
+
+    return (file_a->size < file_b->size) - (file_a->size > file_b->size);
+}
 
-                tokenize_line(output_fields_copy, output_delimiter);
-                output_code_count = 0;
-                for (int index = 0; tokens[index] != NULL; index++) {
-                    output_code[output_code_count++] = parse_expression(tokens[index], variables);
-                }
-            }
+/**
+ * Length of name without a trailing ".gz", or 0 when it isn't a ".csv" or
+ * ".csv.gz" file. Output is only compressed when asked for with --gzip.
+ */
+size_t csv_file_name_len(const char *name) {
+    size_t len = strlen(name);
+    if (len > 3 && strcmp(name + len - 3, ".gz") == 0) {
+        len -= 3;
+    }
+
+    return (len >= 4 && strncmp(name + len - 4, ".csv", 4) == 0) ? len : 0;
+}
+
+/**
+ * Collects the .csv files of input_dir, largest first, so the long running
+ * files are started early and don't end up as the tail of the run.
+ */
+int csv_file_scan(const char *input_dir, const char *output_dir, CsvFile **files) {
+    DIR *dir = opendir(input_dir);
+    if (dir == NULL) {
+        fprintf(stderr, "Error opening input directory: \"%s\"\n", input_dir);
+        exit(EXIT_FAILURE);
+    }
+
+    int count = 0;
+    *files = NULL;
+
+    const char *output_ext = var_get_num("output_gzip", 0) > 0 ? ".gz" : "";
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_type != DT_REG) {
+            continue;
+        }
+
+        size_t name_len = csv_file_name_len(entry->d_name);
+        if (name_len == 0) {
+            continue;
+        }
+
+        CsvFile *grown = (CsvFile *) mem_realloc(*files, (count + 1) * sizeof(CsvFile), count * sizeof(CsvFile));
+        if (grown == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        *files = grown;
+
+        CsvFile *file = &(*files)[count];
+        size_t input_len = strlen(input_dir) + strlen(entry->d_name) + 2;
+        size_t output_len = strlen(output_dir) + name_len + strlen(output_ext) + 2;
+        file->input_filename = (char *) mem_malloc(input_len);
+        file->output_filename = (char *) mem_malloc(output_len);
+        if (file->input_filename == NULL || file->output_filename == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        snprintf(file->input_filename, input_len, "%s/%s", input_dir, entry->d_name);
+        if (strcmp(output_dir, "-") == 0) {
+            strcpy(file->output_filename, output_dir);
         }
         else {
-            assign_variables_value();
+            snprintf(file->output_filename, output_len, "%s/%.*s%s", output_dir, (int) name_len, entry->d_name, output_ext);
         }
 
-        bool is_true = execute_code(input_code, variables) != 0;
-        if (!is_true) continue;
+        struct stat st;
+        file->size = stat(file->input_filename, &st) == 0 ? st.st_size : 0;
 
-        written_lines ++;
- 
-        if (!output_code_count) {
-            fwrite(copy_line, sizeof(char), strlen(copy_line), outputFile);
-            continue;
+        count ++;
+    }
+    closedir(dir);
+
+    qsort(*files, count, sizeof(CsvFile), csv_file_compare);
+
+    return count;
+}
+
+void *file_worker(void *arg) {
+    FilePool *pool = (FilePool *) arg;
+
+    while (true) {
+        pthread_mutex_lock(&pool->lock);
+        int index = pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (index >= pool->count) {
+            break;
         }
 
-        char output_line[MAX_LINE_LENGTH];
-        char *output_line_ptr = output_line;
-        output_line[0] = '\0';
+        const CsvFile *file = &pool->files[index];
+        process_csv(file->input_filename, file->output_filename, pool->expr);
+    }
+
+    return NULL;
+}
 
-        for (int index = 0; index < output_code_count; index++) {
-            const Variable res = execute_code_datatype(output_code[index], variables);
-            switch (res.type) {
-                case VAR_NUMBER:
-                    sprintf(output_line_ptr, "%f", res.value);
-                    break;
+/**
+ * Processes the files on a pool of jobs threads. Every process_csv() call
+ * runs on its own Context, so the workers only share the read-only config.
+ */
+void process_files(CsvFile *files, int count, const char *expr, int jobs) {
+    FilePool pool = {
+        .files = files,
+        .count = count,
+        .next = 0,
+        .expr = expr
+    };
 
-                case VAR_STRING:
-                    sprintf(output_line_ptr, "%s", res.str);
-                    if (res.type == VAR_STRING && res.is_dynamic) mem_free((void *) res.str);
-                    break;
+    if (jobs > count) {
+        jobs = count;
+    }
 
-                case VAR_DATETIME:
-                    {
-                        char buffer[20];
-                        strftime(buffer, sizeof(buffer), DATE_FORMAT, &res.datetime);
-                        sprintf(output_line_ptr, "%s", buffer);
-                    }
-                    break;
+    if (jobs <= 1) {
+        file_worker(&pool);
+        return;
+    }
 
-                default:
-                    fprintf(stderr, "Unknown variable type %d!\n", res.type);
-                    exit(EXIT_FAILURE);
-            }
+    pthread_t *workers = (pthread_t *) mem_malloc(jobs * sizeof(pthread_t));
+    if (workers == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
 
-            output_line_ptr = output_line + strlen(output_line);
-            if (index < output_code_count - 1) {
-                sprintf(output_line_ptr, "%s", output_delimiter);
-                output_line_ptr = output_line + strlen(output_line);
-            }
+    pthread_mutex_init(&pool.lock, NULL);
+    for (int index = 0; index < jobs; index++) {
+        if (pthread_create(&workers[index], NULL, file_worker, &pool) != 0) {
+            fprintf(stderr, "Error: Can't start worker thread\n");
+            exit(EXIT_FAILURE);
         }
-        fwrite(output_line, sizeof(char), strlen(output_line), outputFile);
-        fwrite("\n", sizeof(char), strlen("\n"), outputFile);
     }
 
-    double pct_written = (double)written_lines * 100 / total_lines;
-    printf(
-        COLOR_YELLOW "\nWritten %s: %d of %d lines written (%.1f%%)\n" COLOR_RESET, 
-        output_filename, written_lines, total_lines, pct_written
-    );
-
-    fclose(inputFile);
-    fclose(outputFile);
+    for (int index = 0; index < jobs; index++) {
+        pthread_join(workers[index], NULL);
+    }
+    pthread_mutex_destroy(&pool.lock);
 
-    mem_free((void *) output_fields_copy);
+    mem_free(workers);
+}
 
-    for (int index=0; index < output_code_count; index++) {
-        parse_cleaning(output_code[index]);
+void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [options] <conf file> | <input_directory> <output_directory|-> <expression> | - - <expression>\n", name);
+    fprintf(stderr, "Options:\n");
+    for (int idx = 0; options[idx].option != NULL; idx++) {
+        fprintf(stderr, "    %-16s %s\n", options[idx].option, options[idx].help);
     }
-    parse_cleaning(input_code);
-    var_cleaning(false);
 }
 
 int main(int argc, char *argv[]) {
@@ -472,6 +1426,7 @@ int main(int argc, char *argv[]) {
     };
     variables_base = 0;
     variables[variables_base].type = VAR_END;
+    token_init();
     
     const char *home_dir_env = getenv("HOME");
     if (home_dir_env != NULL) {
@@ -482,51 +1437,81 @@ int main(int argc, char *argv[]) {
         conf_add_key_str(&config, "home_dir", home_dir_env);
     }
 
-    if (argc == 2) {
-        conf_read_file(&config, argv[1]);
+    int argi = 1;
+    while (argi < argc && strncmp(argv[argi], "--", 2) == 0) {
+        int idx = 0;
+        while (options[idx].option != NULL && strcmp(options[idx].option, argv[argi]) != 0) {
+            idx++;
+        }
+
+        if (options[idx].option == NULL || (options[idx].value == NULL && argi + 1 >= argc)) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        if (options[idx].value == NULL) {
+            conf_add_key_value(&config, options[idx].key, argv[argi + 1]);
+            argi += 2;
+        }
+        else {
+            conf_add_key_value(&config, options[idx].key, options[idx].value);
+            argi += 1;
+        }
+    }
+
+    if (argc - argi == 1) {
+        conf_read_file(&config, argv[argi]);
     }
-    else if (argc == 4) {
-        conf_add_key_str(&config, "source_dir", argv[1]);
-        conf_add_key_str(&config, "dest_dir", argv[2]);
-        conf_add_key_str(&config, "input_script", argv[3]);
+    else if (argc - argi == 3) {
+        conf_add_key_str(&config, "source_dir", argv[argi]);
+        conf_add_key_str(&config, "dest_dir", argv[argi + 1]);
+        conf_add_key_value(&config, "input_script", argv[argi + 2]);
     }
     assign_variables_config(&config);
+    schema_init();
 
     const char *input_dir = var_get_str("source_dir", NULL);
     const char *output_dir = var_get_str("dest_dir", NULL);
     const char *expr = var_get_str("input_script", NULL);
 
     if (!input_dir || !output_dir || !expr) {
-        fprintf(stderr, "Usage: %s <conf file> | <input_directory> <output_directory> <expression>\n", argv[0]);
+        usage(argv[0]);
         return EXIT_FAILURE;
     }
 
-    DIR *dir = opendir(input_dir);
-    if (dir == NULL) {
-        fprintf(stderr, "Error opening input directory: \"%s\"\n", input_dir);
+    if (var_get_num("threads", 1) < 1 || var_get_num("jobs", 1) < 1) {
+        fprintf(stderr, "Error: threads and jobs must be at least 1\n");
         return EXIT_FAILURE;
     }
 
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
-        if (entry->d_type != DT_REG) {
-            continue;
-        }
-
-        const char *ext = strrchr(entry->d_name, '.');
-        if (ext && strcmp(ext, ".csv") == 0) {
-            char input_filename[strlen(input_dir) + strlen(entry->d_name) + 2];
-            char output_filename[strlen(output_dir) + strlen(entry->d_name) + 2];
-            snprintf(input_filename, sizeof(input_filename), "%s/%s", input_dir, entry->d_name);
-            snprintf(output_filename, sizeof(output_filename), "%s/%s", output_dir, entry->d_name);
+    // "-" streams stdin and / or stdout, e.g. in a shell pipeline
+    bool to_stdout = strcmp(output_dir, "-") == 0;
+    bool from_stdin = strcmp(input_dir, "-") == 0;
+    if (from_stdin && !to_stdout) {
+        fprintf(stderr, "Error: Input from stdin is written to stdout, use \"-\" as output directory\n");
+        return EXIT_FAILURE;
+    }
 
-            process_csv(input_filename, output_filename, expr);
+    if (from_stdin) {
+        process_csv(input_dir, output_dir, expr);
+    }
+    else {
+        CsvFile *files;
+        int count = csv_file_scan(input_dir, output_dir, &files);
+        process_files(files, count, expr, to_stdout ? 1 : (int) var_get_num("jobs", 1));
+
+        for (int index = 0; index < count; index++) {
+            mem_free(files[index].input_filename);
+            mem_free(files[index].output_filename);
         }
+        mem_free(files);
     }
-    closedir(dir);
 
+    plan_cleaning();
+    match_cleaning();
+    schema_cleaning();
     conf_cleaning(&config);
-    var_cleaning(true);
+    var_cleaning(variables, true);
     mem_cleaning();
     
     return EXIT_SUCCESS;
@@ -0,0 +1,331 @@
+/**
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 43):
+ *
+ * GitHub Co-pilot and <jens@bennerhq.com> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ *
+ * /benner
+ * ----------------------------------------------------------------------------
+ */
+
+/**
+ * gzip.c - Streaming gzip decompression, and block parallel compression,
+ *          on top of zlib
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <zlib.h>
+
+#include "../hdr/dmalloc.h"
+#include "../hdr/gzip.h"
+#include "../hdr/queue.h"
+
+#define GZIP_INPUT_SIZE     (1024 * 256)
+#define GZIP_BLOCK_SIZE     (1024 * 1024)
+#define GZIP_WINDOW_BITS    (15 + 16)
+#define GZIP_MEM_LEVEL      (8)
+
+struct GzipReader {
+    int fd;
+    z_stream stream;
+    unsigned char *input;
+    bool eof;
+    bool in_member;
+};
+
+bool gzip_is_magic(const char *data, size_t len) {
+    return len >= 2 && (unsigned char) data[0] == GZIP_MAGIC_0 && (unsigned char) data[1] == GZIP_MAGIC_1;
+}
+
+/**
+ * Starts decompressing fd. The prefix holds bytes already read from fd while
+ * sniffing for the gzip magic.
+ */
+GzipReader *gzip_reader_open(int fd, const char *prefix, size_t prefix_len) {
+    GzipReader *gzip = (GzipReader *) mem_malloc(sizeof(GzipReader));
+    if (gzip == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    gzip->input = (unsigned char *) mem_malloc(GZIP_INPUT_SIZE > prefix_len ? GZIP_INPUT_SIZE : prefix_len);
+    if (gzip->input == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(gzip->input, prefix, prefix_len);
+
+    gzip->fd = fd;
+    gzip->eof = false;
+    gzip->in_member = false;
+
+    memset(&gzip->stream, 0, sizeof(gzip->stream));
+    gzip->stream.next_in = gzip->input;
+    gzip->stream.avail_in = prefix_len;
+    if (inflateInit2(&gzip->stream, GZIP_WINDOW_BITS) != Z_OK) {
+        fprintf(stderr, "Error: Can't initialize gzip decompression\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return gzip;
+}
+
+/**
+ * Decompresses up to size bytes into buf, returning 0 at the end of input.
+ * Concatenated gzip members, as written by pigz and friends, are read as
+ * one stream.
+ */
+ssize_t gzip_reader_read(GzipReader *gzip, char *buf, size_t size) {
+    z_stream *stream = &gzip->stream;
+    stream->next_out = (unsigned char *) buf;
+    stream->avail_out = size;
+
+    while (stream->avail_out == size) {
+        if (stream->avail_in == 0 && !gzip->eof) {
+            ssize_t len = read(gzip->fd, gzip->input, GZIP_INPUT_SIZE);
+            if (len < 0) {
+                return -1;
+            }
+
+            gzip->eof = (len == 0);
+            stream->next_in = gzip->input;
+            stream->avail_in = len;
+        }
+
+        if (stream->avail_in == 0) {
+            if (gzip->in_member) {
+                fprintf(stderr, "Error: Truncated gzip input\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        }
+
+        gzip->in_member = true;
+        int ret = inflate(stream, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END) {
+            gzip->in_member = false;
+            inflateReset(stream);
+        }
+        else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            fprintf(stderr, "Error: Corrupt gzip input (%s)\n", stream->msg ? stream->msg : "unknown");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return size - stream->avail_out;
+}
+
+void gzip_reader_close(GzipReader *gzip) {
+    inflateEnd(&gzip->stream);
+    mem_free(gzip->input);
+    mem_free(gzip);
+}
+
+typedef struct {
+    Buffer input;
+    Buffer output;
+} GzipJob;
+
+typedef struct {
+    Queue in;
+    Queue out;
+    pthread_t thread;
+} GzipWorker;
+
+/**
+ * Output is cut into blocks that are compressed as independent gzip members.
+ * Blocks are dealt round robin to the workers, and the writer thread collects
+ * them in the same order, so every queue has one producer and one consumer.
+ */
+struct GzipWriter {
+    FILE *file;
+
+    GzipJob *jobs;
+    int job_count;
+    Queue free;
+    GzipJob *current;
+
+    GzipWorker *workers;
+    int worker_count;
+    long next;
+
+    pthread_t thread;
+};
+
+void *gzip_worker_thread(void *arg) {
+    GzipWorker *worker = (GzipWorker *) arg;
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, GZIP_WINDOW_BITS, GZIP_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+        fprintf(stderr, "Error: Can't initialize gzip compression\n");
+        exit(EXIT_FAILURE);
+    }
+
+    GzipJob *job;
+    while ((job = (GzipJob *) queue_pop(&worker->in)) != NULL) {
+        buffer_reserve(&job->output, deflateBound(&stream, job->input.len));
+
+        stream.next_in = (unsigned char *) job->input.data;
+        stream.avail_in = job->input.len;
+        stream.next_out = (unsigned char *) job->output.data;
+        stream.avail_out = job->output.size;
+        if (deflate(&stream, Z_FINISH) != Z_STREAM_END) {
+            fprintf(stderr, "Error: Can't compress output\n");
+            exit(EXIT_FAILURE);
+        }
+
+        job->output.len = stream.total_out;
+        deflateReset(&stream);
+
+        queue_push(&worker->out, job);
+    }
+    queue_push(&worker->out, NULL);
+
+    deflateEnd(&stream);
+    return NULL;
+}
+
+void *gzip_writer_thread(void *arg) {
+    GzipWriter *gzip = (GzipWriter *) arg;
+
+    GzipJob *job;
+    for (long seq = 0; (job = (GzipJob *) queue_pop(&gzip->workers[seq % gzip->worker_count].out)) != NULL; seq++) {
+        if (fwrite(job->output.data, sizeof(char), job->output.len, gzip->file) != job->output.len) {
+            fprintf(stderr, "Error writing output\n");
+            exit(EXIT_FAILURE);
+        }
+
+        job->input.len = 0;
+        queue_push(&gzip->free, job);
+    }
+
+    return NULL;
+}
+
+/**
+ * Starts threads compressing the output blocks, plus a thread writing the
+ * compressed blocks to file in order.
+ */
+GzipWriter *gzip_writer_open(FILE *file, int threads) {
+    GzipWriter *gzip = (GzipWriter *) mem_malloc(sizeof(GzipWriter));
+    if (gzip == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    gzip->file = file;
+    gzip->worker_count = threads < 1 ? 1 : threads;
+    gzip->job_count = gzip->worker_count * 2 + 1;
+    gzip->current = NULL;
+    gzip->next = 0;
+
+    gzip->jobs = (GzipJob *) mem_malloc(gzip->job_count * sizeof(GzipJob));
+    gzip->workers = (GzipWorker *) mem_malloc(gzip->worker_count * sizeof(GzipWorker));
+    if (gzip->jobs == NULL || gzip->workers == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    queue_init(&gzip->free, gzip->job_count);
+    for (int index = 0; index < gzip->job_count; index++) {
+        gzip->jobs[index].input = (Buffer) { .data = NULL, .len = 0, .size = 0 };
+        gzip->jobs[index].output = (Buffer) { .data = NULL, .len = 0, .size = 0 };
+        queue_push(&gzip->free, &gzip->jobs[index]);
+    }
+
+    // One extra slot for the NULL that stops the thread
+    for (int index = 0; index < gzip->worker_count; index++) {
+        GzipWorker *worker = &gzip->workers[index];
+        queue_init(&worker->in, gzip->job_count + 1);
+        queue_init(&worker->out, gzip->job_count + 1);
+
+        if (pthread_create(&worker->thread, NULL, gzip_worker_thread, worker) != 0) {
+            fprintf(stderr, "Error: Can't start compression thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (pthread_create(&gzip->thread, NULL, gzip_writer_thread, gzip) != 0) {
+        fprintf(stderr, "Error: Can't start writer thread\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return gzip;
+}
+
+void gzip_writer_dispatch(GzipWriter *gzip) {
+    queue_push(&gzip->workers[gzip->next % gzip->worker_count].in, gzip->current);
+    gzip->current = NULL;
+    gzip->next ++;
+}
+
+/**
+ * Queues and empties output. Small writes are gathered into blocks of at
+ * least GZIP_BLOCK_SIZE, as every block costs a gzip header and a reset
+ * dictionary. Large writes are swapped in without copying.
+ */
+void gzip_writer_write(GzipWriter *gzip, Buffer *output) {
+    if (output->len == 0) {
+        return;
+    }
+
+    if (gzip->current == NULL) {
+        gzip->current = (GzipJob *) queue_pop(&gzip->free);
+    }
+
+    Buffer *input = &gzip->current->input;
+    if (input->len == 0 && output->len >= GZIP_BLOCK_SIZE) {
+        Buffer swap = *input;
+        *input = *output;
+        *output = swap;
+    }
+    else {
+        buffer_append(input, output->data, output->len);
+        output->len = 0;
+    }
+
+    if (input->len >= GZIP_BLOCK_SIZE) {
+        gzip_writer_dispatch(gzip);
+    }
+}
+
+/**
+ * Flushes the last block and stops the threads. Empty output still gets one
+ * empty member, so the file is valid gzip.
+ */
+void gzip_writer_close(GzipWriter *gzip) {
+    if (gzip->current == NULL && gzip->next == 0) {
+        gzip->current = (GzipJob *) queue_pop(&gzip->free);
+    }
+    if (gzip->current) {
+        gzip_writer_dispatch(gzip);
+    }
+
+    for (int index = 0; index < gzip->worker_count; index++) {
+        queue_push(&gzip->workers[(gzip->next + index) % gzip->worker_count].in, NULL);
+    }
+    for (int index = 0; index < gzip->worker_count; index++) {
+        pthread_join(gzip->workers[index].thread, NULL);
+    }
+    pthread_join(gzip->thread, NULL);
+
+    for (int index = 0; index < gzip->worker_count; index++) {
+        queue_free(&gzip->workers[index].in);
+        queue_free(&gzip->workers[index].out);
+    }
+    for (int index = 0; index < gzip->job_count; index++) {
+        buffer_free(&gzip->jobs[index].input);
+        buffer_free(&gzip->jobs[index].output);
+    }
+    queue_free(&gzip->free);
+    mem_free(gzip->workers);
+    mem_free(gzip->jobs);
+    mem_free(gzip);
+}
@@ -0,0 +1,305 @@
+/**
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 43):
+ *
+ * GitHub Co-pilot and <jens@bennerhq.com> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ *
+ * /benner
+ * ----------------------------------------------------------------------------
+ */
+
+/**
+ * match.c - Compiled patterns for the 'rin' operator
+ *
+ * A pattern is compiled once, either when the expression is parsed or the
+ * first time a dynamic pattern is seen. The longest run of plain characters
+ * every match must contain is pulled out of the pattern and searched for with
+ * memmem first, so most rows never reach the regex engine, and a pattern
+ * without any regex syntax never uses it at all. Compiled patterns run on the
+ * lazy DFA in dfa.c when they fit its subset, and on regexec otherwise.
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <regex.h>
+
+#include "../hdr/dmalloc.h"
+#include "../hdr/match.h"
+#include "../hdr/dfa.h"
+
+#define MATCH_NEVER     (0)     // Empty pattern, matches nothing
+#define MATCH_LITERAL   (1)     // Plain characters, memmem does it all
+#define MATCH_REGEX     (2)     // POSIX regexec
+#define MATCH_DFA       (3)
+
+struct Match {
+    int kind;
+    char *pattern;
+    char *literal;          // Every match contains this
+    size_t literal_len;
+    regex_t regex;
+    Dfa *dfa;
+};
+
+// Dynamic patterns, a slot is set once and kept until match_cleaning
+_Atomic(Match *) match_cache[MATCH_CACHE_SIZE];
+
+/**
+ * Skips a bracket expression, pos is at the '['.
+ */
+const char *match_skip_bracket(const char *pos) {
+    pos++;
+    if (*pos == '^') pos++;
+    if (*pos == ']') pos++;
+
+    while (*pos && *pos != ']') {
+        if (pos[0] == '[' && (pos[1] == ':' || pos[1] == '.' || pos[1] == '=')) {
+            const char *end = strchr(pos + 2, pos[1]);
+            pos = (end != NULL && end[1] == ']') ? end + 2 : pos + 1;
+        }
+        else {
+            pos++;
+        }
+    }
+    return *pos ? pos + 1 : pos;
+}
+
+/**
+ * Skips a group with what it nests, pos is at the '('.
+ */
+const char *match_skip_group(const char *pos) {
+    int depth = 0;
+    while (*pos) {
+        if (*pos == '\\' && pos[1]) {
+            pos += 2;
+            continue;
+        }
+        if (*pos == '[') {
+            pos = match_skip_bracket(pos);
+            continue;
+        }
+        if (*pos == '(') depth++;
+        if (*pos == ')' && --depth == 0) return pos + 1;
+        pos++;
+    }
+    return pos;
+}
+
+/**
+ * The longest run of plain characters every match of the extended regex
+ * contains, copied to literal. Groups and bracket expressions end a run, a
+ * '*', '?' or '{' takes back the character before it, and an alternation
+ * outside a group means there's no such run. Exact is set when the pattern
+ * is nothing but the run. Both literal and run hold strlen(pattern) + 1.
+ */
+size_t match_required(const char *pattern, char *literal, char *run, bool *exact) {
+    size_t run_len = 0;
+    size_t best = 0;
+
+    *exact = true;
+    const char *pos = pattern;
+    while (*pos) {
+        char c = *pos;
+        if (c == '\\' && pos[1] && strchr(".[]()*+?{}|^$\\/", pos[1])) {
+            run[run_len++] = pos[1];
+            pos += 2;
+            continue;
+        }
+        if (c == '|') {
+            *exact = false;
+            best = run_len = 0;
+            break;
+        }
+        if (strchr("\\*?{+([.^$", c) == NULL) {
+            run[run_len++] = c;
+            pos++;
+            continue;
+        }
+
+        *exact = false;
+        if ((c == '*' || c == '?' || c == '{') && run_len > 0) {
+            run_len--;
+        }
+        if (run_len > best) {
+            memcpy(literal, run, run_len);
+            best = run_len;
+        }
+        run_len = 0;
+
+        if (c == '(') {
+            pos = match_skip_group(pos);
+        }
+        else if (c == '[') {
+            pos = match_skip_bracket(pos);
+        }
+        else if (c == '{' && strchr(pos, '}') != NULL) {
+            pos = strchr(pos, '}') + 1;
+        }
+        else {
+            pos += (c == '\\' && pos[1]) ? 2 : 1;
+        }
+    }
+
+    if (*exact || run_len > best) {
+        memcpy(literal, run, run_len);
+        best = run_len;
+    }
+    literal[best] = '\0';
+    return best;
+}
+
+/**
+ * Sets up match for pattern without copying it. The buffer holds twice
+ * strlen(pattern) + 1, the literal is kept in its first half. False when the
+ * pattern isn't an extended regex, the empty pattern matches nothing.
+ */
+bool match_init(Match *match, const char *pattern, char *buffer) {
+    size_t len = strlen(pattern);
+
+    bool exact;
+    *match = (Match) {
+        .kind = len == 0 ? MATCH_NEVER : MATCH_REGEX,
+        .pattern = (char *) pattern,
+        .literal = buffer,
+        .literal_len = match_required(pattern, buffer, buffer + len + 1, &exact)
+    };
+
+    if (match->kind == MATCH_REGEX && exact) {
+        match->kind = MATCH_LITERAL;
+    }
+    else if (match->kind == MATCH_REGEX && regcomp(&match->regex, pattern, REG_EXTENDED | REG_NOSUB) != 0) {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Compiles a pattern for keeps, NULL when it isn't an extended regex.
+ */
+Match *match_compile(const char *pattern) {
+    size_t len = strlen(pattern);
+    Match *match = (Match *) mem_malloc(sizeof(Match));
+    char *copy = (char *) mem_malloc(len + 1);
+    char *buffer = (char *) mem_malloc(2 * (len + 1));
+    if (match == NULL || copy == NULL || buffer == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(copy, pattern, len + 1);
+
+    if (!match_init(match, copy, buffer)) {
+        mem_free(copy);
+        mem_free(buffer);
+        mem_free(match);
+        return NULL;
+    }
+
+    if (match->kind == MATCH_REGEX && (match->dfa = dfa_compile(pattern)) != NULL) {
+        regfree(&match->regex);
+        match->kind = MATCH_DFA;
+    }
+    return match;
+}
+
+bool match_exec(const Match *match, const char *str) {
+    switch (match->kind) {
+        case MATCH_LITERAL:
+            return memmem(str, strlen(str), match->literal, match->literal_len) != NULL;
+
+        case MATCH_REGEX:
+            if (match->literal_len > 0 && memmem(str, strlen(str), match->literal, match->literal_len) == NULL) {
+                return false;
+            }
+            return regexec(&match->regex, str, 0, NULL, 0) == 0;
+
+        case MATCH_DFA:
+            if (match->literal_len > 0 && memmem(str, strlen(str), match->literal, match->literal_len) == NULL) {
+                return false;
+            }
+            return dfa_match(match->dfa, str);
+
+        default:
+            return false;
+    }
+}
+
+/**
+ * Matches a pattern only known while running. The compiled pattern is kept
+ * in a slot picked by its hash. When the slot already holds another pattern
+ * it is set up on the stack for this row only, so a cache that's full costs
+ * what no cache did.
+ */
+bool match_dynamic(const char *pattern, const char *str) {
+    if (*pattern == '\0') {
+        return false;
+    }
+
+    uint32_t hash = 2166136261u;
+    for (const char *pos = pattern; *pos; pos++) {
+        hash = (hash ^ (unsigned char) *pos) * 16777619u;
+    }
+
+    _Atomic(Match *) *slot = &match_cache[hash % MATCH_CACHE_SIZE];
+    Match *match = atomic_load_explicit(slot, memory_order_acquire);
+    if (match != NULL && strcmp(match->pattern, pattern) == 0) {
+        return match_exec(match, str);
+    }
+
+    size_t len = strlen(pattern);
+    if (match != NULL && len < MATCH_ROW_LEN) {
+        char buffer[2 * MATCH_ROW_LEN];
+        Match row;
+        if (!match_init(&row, pattern, buffer)) {
+            return false;
+        }
+
+        bool found = match_exec(&row, str);
+        if (row.kind == MATCH_REGEX) {
+            regfree(&row.regex);
+        }
+        return found;
+    }
+
+    Match *compiled = match_compile(pattern);
+    if (compiled == NULL) {
+        return false;
+    }
+
+    bool found = match_exec(compiled, str);
+    Match *empty = NULL;
+    if (match != NULL || !atomic_compare_exchange_strong(slot, &empty, compiled)) {
+        match_free(compiled);
+    }
+    return found;
+}
+
+const char *match_pattern(const Match *match) {
+    return match->pattern;
+}
+
+void match_free(Match *match) {
+    if (match == NULL) {
+        return;
+    }
+
+    if (match->kind == MATCH_REGEX) {
+        regfree(&match->regex);
+    }
+    dfa_free(match->dfa);
+    mem_free(match->pattern);
+    mem_free(match->literal);
+    mem_free(match);
+}
+
+void match_cleaning() {
+    for (int index = 0; index < MATCH_CACHE_SIZE; index++) {
+        match_free(atomic_exchange(&match_cache[index], NULL));
+    }
+}
@@ -0,0 +1,215 @@
+/**
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 43):
+ *
+ * GitHub Co-pilot and <jens@bennerhq.com> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ *
+ * /benner
+ * ----------------------------------------------------------------------------
+ */
+
+/**
+ * number.c - Locale independent decimal number parser for length delimited
+ *            fields
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <strings.h>
+#include <math.h>
+
+#include "../hdr/dmalloc.h"
+#include "../hdr/number.h"
+
+#define NUMBER_MAX_DIGITS       (19)
+#define NUMBER_MAX_EXPONENT     (100000)
+#define NUMBER_EXACT_POW10      (22)
+#define NUMBER_EXACT_MANTISSA   ((uint64_t) 1 << 53)
+#define NUMBER_COPY_SIZE        (64)
+
+const double number_pow10[NUMBER_EXACT_POW10 + 1] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+bool number_is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+/**
+ * Numbers the fast path can't round exactly are handed to strtod, on a NUL
+ * terminated copy of the part that was already validated.
+ */
+double number_slow(const char *str, size_t len) {
+    char local[NUMBER_COPY_SIZE];
+    char *copy = len < sizeof(local) ? local : (char *) mem_malloc(len + 1);
+    if (copy == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    double value = strtod(copy, NULL);
+
+    if (copy != local) {
+        mem_free(copy);
+    }
+    return value;
+}
+
+/**
+ * Parses "inf", "infinity" and "nan" in any case, like strtod does.
+ */
+size_t number_parse_special(const char *pos, const char *end, bool negative, double *value) {
+    size_t left = end - pos;
+
+    if (left >= 8 && strncasecmp(pos, "infinity", 8) == 0) {
+        *value = negative ? -INFINITY : INFINITY;
+        return 8;
+    }
+    if (left >= 3 && strncasecmp(pos, "inf", 3) == 0) {
+        *value = negative ? -INFINITY : INFINITY;
+        return 3;
+    }
+    if (left >= 3 && strncasecmp(pos, "nan", 3) == 0) {
+        *value = negative ? -NAN : NAN;
+        return 3;
+    }
+
+    return 0;
+}
+
+/**
+ * Parses the decimal number at the start of the len bytes at str, never
+ * reading past them. Returns the number of bytes used, so a field is a valid
+ * number when that is all of it, or 0 with value 0 when there's no number,
+ * just like strtod.
+ *
+ * Up to 19 significant digits are gathered in an integer. When that mantissa
+ * fits in 53 bits and the power of ten is at most 22, both are exact doubles,
+ * and one multiplication or division gives the correctly rounded result
+ * (Clinger's fast path). Everything else, rare in real data, goes to strtod.
+ */
+size_t number_parse(const char *str, size_t len, double *value) {
+    const char *pos = str;
+    const char *end = str + len;
+    *value = 0;
+
+    bool negative = false;
+    if (pos < end && (*pos == '+' || *pos == '-')) {
+        negative = (*pos == '-');
+        pos++;
+    }
+
+    const char *digits_start = pos;
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool exact = true;
+    bool has_digits = false;
+
+    for (; pos < end && number_is_digit(*pos); pos++) {
+        has_digits = true;
+        if (digits < NUMBER_MAX_DIGITS) {
+            mantissa = mantissa * 10 + (*pos - '0');
+            digits += (mantissa != 0);
+        }
+        else {
+            exponent++;
+            exact &= (*pos == '0');
+        }
+    }
+
+    if (pos < end && *pos == '.') {
+        pos++;
+        for (; pos < end && number_is_digit(*pos); pos++) {
+            has_digits = true;
+            if (digits < NUMBER_MAX_DIGITS) {
+                mantissa = mantissa * 10 + (*pos - '0');
+                digits += (mantissa != 0);
+                exponent--;
+            }
+            else {
+                exact &= (*pos == '0');
+            }
+        }
+    }
+
+    if (!has_digits) {
+        size_t special = number_parse_special(digits_start, end, negative, value);
+        return special ? (size_t) (digits_start - str) + special : 0;
+    }
+
+    // An exponent only counts with at least one digit, "1e" is the number 1
+    if (pos < end && (*pos == 'e' || *pos == 'E')) {
+        const char *exp_pos = pos + 1;
+        bool exp_negative = false;
+        if (exp_pos < end && (*exp_pos == '+' || *exp_pos == '-')) {
+            exp_negative = (*exp_pos == '-');
+            exp_pos++;
+        }
+
+        if (exp_pos < end && number_is_digit(*exp_pos)) {
+            int exp_value = 0;
+            for (; exp_pos < end && number_is_digit(*exp_pos); exp_pos++) {
+                if (exp_value < NUMBER_MAX_EXPONENT) {
+                    exp_value = exp_value * 10 + (*exp_pos - '0');
+                }
+            }
+            exponent += exp_negative ? -exp_value : exp_value;
+            pos = exp_pos;
+        }
+    }
+
+    size_t used = pos - str;
+    if (mantissa == 0) {
+        *value = negative ? -0.0 : 0.0;
+    }
+    else if (exact && mantissa <= NUMBER_EXACT_MANTISSA && exponent >= -NUMBER_EXACT_POW10 && exponent <= NUMBER_EXACT_POW10) {
+        double result = (double) mantissa;
+        result = exponent < 0 ? result / number_pow10[-exponent] : result * number_pow10[exponent];
+        *value = negative ? -result : result;
+    }
+    else {
+        *value = number_slow(str, used);
+    }
+
+    return used;
+}
+
+/**
+ * Parses a field declared as integer. Plain digits with an optional sign are
+ * summed up directly, anything else, like a fraction or a huge value, is left
+ * to number_parse.
+ */
+size_t number_parse_int(const char *str, size_t len, double *value) {
+    const char *pos = str;
+    const char *end = str + len;
+
+    bool negative = false;
+    if (pos < end && (*pos == '+' || *pos == '-')) {
+        negative = (*pos == '-');
+        pos++;
+    }
+
+    if (pos == end || end - pos > NUMBER_MAX_DIGITS - 1) {
+        return number_parse(str, len, value);
+    }
+
+    int64_t result = 0;
+    for (; pos < end; pos++) {
+        if (!number_is_digit(*pos)) {
+            return number_parse(str, len, value);
+        }
+        result = result * 10 + (*pos - '0');
+    }
+
+    *value = negative ? -(double) result : (double) result;
+    return len;
+}
@@ -0,0 +1,91 @@
+/**
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 43):
+ *
+ * GitHub Co-pilot and <jens@bennerhq.com> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ *
+ * /benner
+ * ----------------------------------------------------------------------------
+ */
+
+/**
+ * queue.c - Bounded lock-free single-producer / single-consumer queue
+ *
+ * The producer only writes tail and the consumer only writes head, so the
+ * two stages never share a lock. A full or empty queue is waited out by
+ * spinning a little and then backing off, which is the normal case while a
+ * stage waits for disk.
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <time.h>
+
+#include "../hdr/dmalloc.h"
+#include "../hdr/queue.h"
+
+#define QUEUE_SPIN_COUNT    (64)
+#define QUEUE_SLEEP_NS      (50 * 1000)
+
+void queue_wait(int *spins) {
+    if (++(*spins) < QUEUE_SPIN_COUNT) {
+        sched_yield();
+        return;
+    }
+
+    struct timespec delay = { .tv_sec = 0, .tv_nsec = QUEUE_SLEEP_NS };
+    nanosleep(&delay, NULL);
+}
+
+void queue_init(Queue *queue, size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) {
+        size *= 2;
+    }
+
+    queue->items = (void **) mem_malloc(size * sizeof(void *));
+    if (queue->items == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    queue->mask = size - 1;
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+}
+
+void queue_push(Queue *queue, void *item) {
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+
+    int spins = 0;
+    while (tail - atomic_load_explicit(&queue->head, memory_order_acquire) > queue->mask) {
+        queue_wait(&spins);
+    }
+
+    queue->items[tail & queue->mask] = item;
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+}
+
+void *queue_pop(Queue *queue) {
+    size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+
+    int spins = 0;
+    while (atomic_load_explicit(&queue->tail, memory_order_acquire) == head) {
+        queue_wait(&spins);
+    }
+
+    void *item = queue->items[head & queue->mask];
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+
+    return item;
+}
+
+void queue_free(Queue *queue) {
+    mem_free(queue->items);
+    queue->items = NULL;
+}
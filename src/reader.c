@@ -0,0 +1,463 @@
+/**
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 43):
+ *
+ * GitHub Co-pilot and <jens@bennerhq.com> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ *
+ * /benner
+ * ----------------------------------------------------------------------------
+ */
+
+/**
+ * reader.c - Zero-copy line reader on top of a memory mapped file, with a
+ *            chunked streaming fallback for input that can't be mapped
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#include "../hdr/dmalloc.h"
+#include "../hdr/reader.h"
+#include "../hdr/buffer.h"
+#include "../hdr/queue.h"
+#include "../hdr/gzip.h"
+
+#define READER_CHUNK_SIZE   (1024 * 1024)
+#define READER_GZIP_BLOCKS  (4)
+
+struct ReadAhead {
+    int fd;
+    GzipReader *gzip;
+    Buffer *blocks;
+    int block_count;
+    Queue full;
+    Queue empty;
+    Buffer *current;
+    size_t offset;
+    pthread_t thread;
+};
+
+void *read_ahead_thread(void *arg) {
+    ReadAhead *ahead = (ReadAhead *) arg;
+
+    while (true) {
+        Buffer *block = (Buffer *) queue_pop(&ahead->empty);
+
+        ssize_t len = ahead->gzip ?
+            gzip_reader_read(ahead->gzip, block->data, block->size) :
+            read(ahead->fd, block->data, block->size);
+        if (len < 0) {
+            fprintf(stderr, "Error reading input\n");
+            exit(EXIT_FAILURE);
+        }
+        block->len = len;
+
+        queue_push(&ahead->full, block);
+        if (len == 0) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Starts a thread that keeps block_count blocks of input read ahead of the
+ * parser, so disk and network latency overlaps with the filtering. With a
+ * gzip reader the thread also does the decompression.
+ */
+void read_ahead_start(Reader *reader, int block_count, GzipReader *gzip) {
+    ReadAhead *ahead = (ReadAhead *) mem_malloc(sizeof(ReadAhead));
+    if (ahead == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    ahead->fd = reader->fd;
+    ahead->gzip = gzip;
+    ahead->block_count = block_count < 2 ? 2 : block_count;
+    ahead->blocks = (Buffer *) mem_malloc(ahead->block_count * sizeof(Buffer));
+    if (ahead->blocks == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    queue_init(&ahead->full, ahead->block_count);
+    queue_init(&ahead->empty, ahead->block_count);
+    for (int index = 0; index < ahead->block_count; index++) {
+        ahead->blocks[index] = (Buffer) { .data = NULL, .len = 0, .size = 0 };
+        buffer_reserve(&ahead->blocks[index], READER_CHUNK_SIZE);
+        queue_push(&ahead->empty, &ahead->blocks[index]);
+    }
+    ahead->current = NULL;
+    ahead->offset = 0;
+
+    if (pthread_create(&ahead->thread, NULL, read_ahead_thread, ahead) != 0) {
+        fprintf(stderr, "Error: Can't start reader thread\n");
+        exit(EXIT_FAILURE);
+    }
+
+    reader->ahead = ahead;
+}
+
+ssize_t read_ahead_read(ReadAhead *ahead, char *buf, size_t size) {
+    if (ahead->current == NULL) {
+        ahead->current = (Buffer *) queue_pop(&ahead->full);
+        ahead->offset = 0;
+    }
+
+    Buffer *block = ahead->current;
+    if (block->len == 0) {
+        return 0;
+    }
+
+    size_t len = block->len - ahead->offset;
+    if (len > size) {
+        len = size;
+    }
+    memcpy(buf, block->data + ahead->offset, len);
+    ahead->offset += len;
+
+    if (ahead->offset == block->len) {
+        ahead->current = NULL;
+        queue_push(&ahead->empty, block);
+    }
+
+    return len;
+}
+
+void read_ahead_stop(ReadAhead *ahead) {
+    while (ahead->current == NULL || ahead->current->len != 0) {
+        if (ahead->current) {
+            queue_push(&ahead->empty, ahead->current);
+        }
+        ahead->current = (Buffer *) queue_pop(&ahead->full);
+    }
+    pthread_join(ahead->thread, NULL);
+
+    if (ahead->gzip) {
+        gzip_reader_close(ahead->gzip);
+    }
+    for (int index = 0; index < ahead->block_count; index++) {
+        buffer_free(&ahead->blocks[index]);
+    }
+    queue_free(&ahead->full);
+    queue_free(&ahead->empty);
+    mem_free(ahead->blocks);
+    mem_free(ahead);
+}
+
+void reader_stream_init(Reader *reader) {
+    reader->buffer_size = READER_CHUNK_SIZE;
+    reader->buffer = (char *) mem_malloc(reader->buffer_size + 1);
+    if (reader->buffer == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+bool reader_map(Reader *reader, size_t size) {
+    reader->size = size;
+    if (reader->size == 0) {
+        return true;
+    }
+
+    void *data = mmap(NULL, reader->size, PROT_READ, MAP_PRIVATE, reader->fd, 0);
+    if (data == MAP_FAILED) {
+        reader_stream_init(reader);
+        return true;
+    }
+    madvise(data, reader->size, MADV_SEQUENTIAL);
+    reader->data = data;
+
+    return true;
+}
+
+/**
+ * Reads the first bytes of a pipe into the stream buffer, enough to tell
+ * gzip input from plain text.
+ */
+void reader_stream_sniff(Reader *reader) {
+    while (reader->end < 2) {
+        ssize_t len = read(reader->fd, reader->buffer + reader->end, reader->buffer_size - reader->end);
+        if (len < 0) {
+            fprintf(stderr, "Error reading input\n");
+            exit(EXIT_FAILURE);
+        }
+        if (len == 0) {
+            break;
+        }
+        reader->end += len;
+    }
+}
+
+bool reader_is_gzip(Reader *reader, bool regular) {
+    if (regular) {
+        char magic[2];
+        return pread(reader->fd, magic, sizeof(magic), 0) == sizeof(magic) && gzip_is_magic(magic, sizeof(magic));
+    }
+
+    return gzip_is_magic(reader->buffer, reader->end);
+}
+
+/**
+ * Opens filename for reading, "-" being stdin. Regular files are memory
+ * mapped when map is set. Other input is streamed, with a reader thread
+ * keeping read_ahead blocks in flight when it's above 0. Gzip input is
+ * recognized by its magic bytes and always streamed through a reader thread
+ * that does the decompression.
+ */
+bool reader_open(Reader *reader, const char *filename, bool map, int read_ahead) {
+    *reader = (Reader) {
+        .fd = -1,
+        .size = 0,
+        .data = NULL,
+        .pos = 0,
+        .tail = NULL,
+        .buffer = NULL,
+        .buffer_size = 0,
+        .start = 0,
+        .end = 0,
+        .scan = 0,
+        .eof = false,
+        .quotes = false,
+        .quoted = false,
+        .ahead = NULL
+    };
+
+    reader->fd = strcmp(filename, "-") == 0 ? STDIN_FILENO : open(filename, O_RDONLY);
+    if (reader->fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(reader->fd, &st) != 0) {
+        reader_close(reader);
+        return false;
+    }
+
+    bool regular = S_ISREG(st.st_mode);
+    if (regular && map && !reader_is_gzip(reader, true)) {
+        return reader_map(reader, (size_t) st.st_size);
+    }
+
+    reader_stream_init(reader);
+    if (!regular) {
+        reader_stream_sniff(reader);
+    }
+
+    GzipReader *gzip = NULL;
+    if (reader_is_gzip(reader, regular)) {
+        gzip = gzip_reader_open(reader->fd, reader->buffer, reader->end);
+        reader->end = 0;
+        if (read_ahead < READER_GZIP_BLOCKS) {
+            read_ahead = READER_GZIP_BLOCKS;
+        }
+    }
+    else if (regular) {
+        reader->size = (size_t) st.st_size;
+    }
+
+    if (read_ahead > 0) {
+        read_ahead_start(reader, read_ahead, gzip);
+    }
+
+    return true;
+}
+
+/**
+ * Moves the unconsumed part of the buffer to the front and reads the next
+ * chunk behind it. The buffer only grows when a single row doesn't fit.
+ */
+void reader_stream_fill(Reader *reader) {
+    if (reader->start > 0) {
+        size_t left = reader->end - reader->start;
+        memmove(reader->buffer, reader->buffer + reader->start, left);
+
+        reader->scan -= reader->start;
+        reader->end = left;
+        reader->start = 0;
+    }
+
+    if (reader->end == reader->buffer_size) {
+        size_t new_size = reader->buffer_size * 2;
+        char *buffer = (char *) mem_realloc(reader->buffer, new_size + 1, reader->buffer_size + 1);
+        if (buffer == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+
+        reader->buffer = buffer;
+        reader->buffer_size = new_size;
+    }
+
+    char *buf = reader->buffer + reader->end;
+    size_t size = reader->buffer_size - reader->end;
+    ssize_t len = reader->ahead ? read_ahead_read(reader->ahead, buf, size) : read(reader->fd, buf, size);
+    if (len < 0) {
+        fprintf(stderr, "Error reading input\n");
+        exit(EXIT_FAILURE);
+    }
+
+    reader->end += len;
+    reader->eof = (len == 0);
+}
+
+/**
+ * Odd or even number of quotes between pos and end.
+ */
+bool reader_quote_parity(const char *pos, const char *end) {
+    bool odd = false;
+    while ((pos = memchr(pos, '"', end - pos)) != NULL) {
+        odd = !odd;
+        pos++;
+    }
+
+    return odd;
+}
+
+/**
+ * Finds the newline ending the row, skipping newlines inside quotes. quoted
+ * holds the quote state at pos, and is carried on to end when no row end is
+ * found, so the search can go on from there.
+ */
+const char *reader_row_end(const char *pos, const char *end, bool *quoted) {
+    while (pos < end) {
+        const char *newline = memchr(pos, '\n', end - pos);
+        *quoted ^= reader_quote_parity(pos, newline ? newline : end);
+
+        if (newline == NULL || !*quoted) {
+            return newline;
+        }
+        pos = newline + 1;
+    }
+
+    return NULL;
+}
+
+const char *reader_find_row_end(Reader *reader, const char *pos, const char *end, bool *quoted) {
+    return reader->quotes ? reader_row_end(pos, end, quoted) : memchr(pos, '\n', end - pos);
+}
+
+bool reader_stream_next_line(Reader *reader, Span *line) {
+    while (true) {
+        const char *start = reader->buffer + reader->scan;
+        const char *end = reader_find_row_end(reader, start, reader->buffer + reader->end, &reader->quoted);
+        if (end) {
+            line->str = reader->buffer + reader->start;
+            line->len = end - line->str + 1;
+
+            reader->start += line->len;
+            reader->scan = reader->start;
+            return true;
+        }
+        reader->scan = reader->end;
+
+        if (reader->eof) {
+            if (reader->start == reader->end) {
+                return false;
+            }
+
+            reader->buffer[reader->end] = '\0';
+            line->str = reader->buffer + reader->start;
+            line->len = reader->end - reader->start;
+            reader->quoted = false;
+
+            reader->start = reader->end;
+            return true;
+        }
+
+        reader_stream_fill(reader);
+    }
+}
+
+/**
+ * Hands out the next line, including its trailing newline, as a span that
+ * stays valid until the next call. With quotes set, a line is a whole CSV row
+ * and may hold quoted newlines. Mapped input points straight into the
+ * mapping. A last line without newline is copied and NUL terminated, so
+ * number parsers never run past the end of the mapped pages.
+ */
+bool reader_next_line(Reader *reader, Span *line) {
+    if (reader->buffer) {
+        return reader_stream_next_line(reader, line);
+    }
+
+    if (reader->pos >= reader->size) {
+        return false;
+    }
+
+    const char *start = reader->data + reader->pos;
+    size_t left = reader->size - reader->pos;
+
+    bool quoted = false;
+    const char *end = reader_find_row_end(reader, start, start + left, &quoted);
+    if (end) {
+        line->str = start;
+        line->len = end - start + 1;
+        reader->pos += line->len;
+        return true;
+    }
+
+    reader->tail = (char *) mem_malloc(left + 1);
+    if (reader->tail == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(reader->tail, start, left);
+    reader->tail[left] = '\0';
+
+    line->str = reader->tail;
+    line->len = left;
+    reader->pos = reader->size;
+
+    return true;
+}
+
+size_t reader_size(const Reader *reader) {
+    return reader->size;
+}
+
+void reader_close(Reader *reader) {
+    if (reader->ahead) {
+        read_ahead_stop(reader->ahead);
+        reader->ahead = NULL;
+    }
+
+    if (reader->data) {
+        munmap((void *) reader->data, reader->size);
+        reader->data = NULL;
+    }
+
+    if (reader->fd >= 0 && reader->fd != STDIN_FILENO) {
+        close(reader->fd);
+        reader->fd = -1;
+    }
+
+    mem_free(reader->tail);
+    reader->tail = NULL;
+
+    mem_free(reader->buffer);
+    reader->buffer = NULL;
+}
+
+Span span_trim(Span span) {
+    const char *start = span.str;
+    const char *end = span.str + span.len;
+
+    while (start < end && isspace((unsigned char)*start)) start++;
+    while (end > start && isspace((unsigned char)end[-1])) end--;
+
+    return (Span) { .str = start, .len = end - start };
+}
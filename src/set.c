@@ -0,0 +1,268 @@
+/**
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 43):
+ *
+ * GitHub Co-pilot and <jens@bennerhq.com> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ *
+ * /benner
+ * ----------------------------------------------------------------------------
+ */
+
+/**
+ * set.c - Hash sets of strings for the 'in' operator
+ *
+ * A set is built once, from a quoted list like "'TRITON', 'LOIRE'" or from a
+ * file with one entry per line, and probed for every row. The strings are
+ * packed in one block, and open addressing keeps a lookup to a hash and
+ * usually a single compare. Entries that are numbers also go in a table of
+ * their own, so a number column is looked up without formatting it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+
+#include "../hdr/dmalloc.h"
+#include "../hdr/set.h"
+#include "../hdr/number.h"
+#include "../hdr/reader.h"
+
+typedef struct {
+    uint32_t hash;
+    uint32_t len;       // 0 for a free slot, empty strings are never added
+    size_t offset;
+} SetEntry;
+
+typedef struct {
+    double value;
+    bool used;
+} SetNumber;
+
+struct Set {
+    char *strings;
+    size_t strings_len;
+    size_t strings_size;
+
+    SetEntry *entries;
+    size_t mask;
+    int count;
+
+    SetNumber *numbers;
+    size_t number_mask;
+    int number_count;
+};
+
+void *set_alloc(size_t size) {
+    void *ptr = mem_malloc(size);
+    if (ptr == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+uint32_t set_hash(const char *str, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t index = 0; index < len; index++) {
+        hash = (hash ^ (unsigned char) str[index]) * 16777619u;
+    }
+    return hash;
+}
+
+uint32_t set_hash_number(double value) {
+    uint64_t bits;
+    value = value == 0 ? 0 : value;     // -0 is 0
+    memcpy(&bits, &value, sizeof(bits));
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdull;
+    bits ^= bits >> 33;
+    return (uint32_t) bits;
+}
+
+Set *set_create() {
+    Set *set = (Set *) set_alloc(sizeof(Set));
+    set->entries = (SetEntry *) set_alloc(SET_MIN_SLOTS * sizeof(SetEntry));
+    set->mask = SET_MIN_SLOTS - 1;
+    set->numbers = (SetNumber *) set_alloc(SET_MIN_SLOTS * sizeof(SetNumber));
+    set->number_mask = SET_MIN_SLOTS - 1;
+    return set;
+}
+
+/**
+ * Slot of str, or of the free slot it would go in.
+ */
+SetEntry *set_find(const Set *set, const char *str, size_t len, uint32_t hash) {
+    for (size_t slot = hash & set->mask; ; slot = (slot + 1) & set->mask) {
+        SetEntry *entry = &set->entries[slot];
+        if (entry->len == 0 ||
+            (entry->hash == hash && entry->len == len && memcmp(set->strings + entry->offset, str, len) == 0)) {
+            return entry;
+        }
+    }
+}
+
+SetNumber *set_find_number(const Set *set, double value) {
+    for (size_t slot = set_hash_number(value) & set->number_mask; ; slot = (slot + 1) & set->number_mask) {
+        SetNumber *number = &set->numbers[slot];
+        if (!number->used || number->value == value) {
+            return number;
+        }
+    }
+}
+
+/**
+ * Doubles the slots once they are half full.
+ */
+void set_grow(Set *set) {
+    SetEntry *entries = set->entries;
+    size_t slots = set->mask + 1;
+
+    set->entries = (SetEntry *) set_alloc(2 * slots * sizeof(SetEntry));
+    set->mask = 2 * slots - 1;
+    for (size_t index = 0; index < slots; index++) {
+        if (entries[index].len != 0) {
+            const SetEntry *entry = &entries[index];
+            *set_find(set, set->strings + entry->offset, entry->len, entry->hash) = *entry;
+        }
+    }
+    mem_free(entries);
+}
+
+void set_grow_numbers(Set *set) {
+    SetNumber *numbers = set->numbers;
+    size_t slots = set->number_mask + 1;
+
+    set->numbers = (SetNumber *) set_alloc(2 * slots * sizeof(SetNumber));
+    set->number_mask = 2 * slots - 1;
+    for (size_t index = 0; index < slots; index++) {
+        if (numbers[index].used) {
+            *set_find_number(set, numbers[index].value) = numbers[index];
+        }
+    }
+    mem_free(numbers);
+}
+
+void set_add(Set *set, const char *str, size_t len) {
+    uint32_t hash = set_hash(str, len);
+    if (len == 0 || set_find(set, str, len, hash)->len != 0) {
+        return;
+    }
+
+    if (set->strings_len + len > set->strings_size) {
+        size_t size = 2 * (set->strings_size + len);
+        set->strings = (char *) mem_realloc(set->strings, size, set->strings_len);
+        if (set->strings == NULL) {
+            fprintf(stderr, "Error: Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        set->strings_size = size;
+    }
+    memcpy(set->strings + set->strings_len, str, len);
+
+    *set_find(set, str, len, hash) = (SetEntry) {
+        .hash = hash,
+        .len = (uint32_t) len,
+        .offset = set->strings_len
+    };
+    set->strings_len += len;
+    if (++set->count * 2 > (int) (set->mask + 1)) {
+        set_grow(set);
+    }
+
+    double value;
+    if (number_parse(str, len, &value) == len) {
+        SetNumber *number = set_find_number(set, value);
+        if (!number->used) {
+            *number = (SetNumber) { .value = value, .used = true };
+            if (++set->number_count * 2 > (int) (set->number_mask + 1)) {
+                set_grow_numbers(set);
+            }
+        }
+    }
+}
+
+bool set_contains(const Set *set, const char *str, size_t len) {
+    return len > 0 && set_find(set, str, len, set_hash(str, len))->len != 0;
+}
+
+bool set_contains_number(const Set *set, double value) {
+    return set->number_count > 0 && set_find_number(set, value)->used;
+}
+
+int set_count(const Set *set) {
+    return set->count;
+}
+
+/**
+ * Parses a list of quoted strings separated by commas, NULL when list is
+ * anything else.
+ */
+Set *set_parse_list(const char *list) {
+    Set *set = set_create();
+
+    const char *pos = list;
+    while (isspace((unsigned char) *pos)) pos++;
+    if (*pos == '\0') {
+        set_free(set);
+        return NULL;
+    }
+
+    while (*pos) {
+        char quote = *pos;
+        const char *end = (quote == '\'' || quote == '"') ? strchr(pos + 1, quote) : NULL;
+        if (end == NULL) {
+            set_free(set);
+            return NULL;
+        }
+        set_add(set, pos + 1, end - pos - 1);
+
+        pos = end + 1;
+        while (isspace((unsigned char) *pos)) pos++;
+        if (*pos == ',') {
+            pos++;
+            while (isspace((unsigned char) *pos)) pos++;
+        }
+        else if (*pos != '\0') {
+            set_free(set);
+            return NULL;
+        }
+    }
+    return set;
+}
+
+/**
+ * Loads a set from a file with one entry per line, blank lines skipped.
+ * NULL when the file can't be read.
+ */
+Set *set_load(const char *filename) {
+    Reader reader;
+    if (!reader_open(&reader, filename, true, 0)) {
+        return NULL;
+    }
+
+    Set *set = set_create();
+    Span line;
+    while (reader_next_line(&reader, &line)) {
+        line = span_trim(line);
+        set_add(set, line.str, line.len);
+    }
+    reader_close(&reader);
+
+    return set;
+}
+
+void set_free(Set *set) {
+    if (set == NULL) {
+        return;
+    }
+
+    mem_free(set->strings);
+    mem_free(set->entries);
+    mem_free(set->numbers);
+    mem_free(set);
+}
@@ -0,0 +1,367 @@
+/**
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 43):
+ *
+ * GitHub Co-pilot and <jens@bennerhq.com> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ *
+ * /benner
+ * ----------------------------------------------------------------------------
+ */
+
+/**
+ * token.c - Splits a row into trimmed fields, scanning for the delimiter, the
+ *           newline and the quote 16 or 32 bytes at a time. Rows with quotes
+ *           finish on a scalar RFC 4180 state machine.
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define TOKEN_X86
+#include <immintrin.h>
+#endif
+
+#include "../hdr/token.h"
+
+typedef enum {
+    TOKEN_MORE,
+    TOKEN_DONE,
+    TOKEN_QUOTE
+} TokenScan;
+
+typedef struct {
+    Span *tokens;
+    int count;
+    int max_tokens;
+    int limit;
+    const char *line;
+    char *scratch;
+} TokenList;
+
+typedef int (*TokenSplit)(TokenList *list, Span line, char delimiter);
+
+bool token_is_space(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+/**
+ * Adds the field from start to end, with the surrounding white space trimmed.
+ * Returns false once the list holds as many fields as asked for.
+ */
+bool token_add(TokenList *list, const char *start, const char *end) {
+    if (list->count + 2 >= list->max_tokens) {
+        fprintf(stderr, "Too many tokens\n");
+        exit(EXIT_FAILURE);
+    }
+
+    while (start < end && token_is_space(*start)) start++;
+    while (end > start && token_is_space(end[-1])) end--;
+
+    list->tokens[list->count++] = (Span) { .str = start, .len = end - start };
+    return list->count < list->limit;
+}
+
+/**
+ * Adds a field holding quotes. A plain "..." field is handed out as the span
+ * between the quotes. Anything else is unescaped, in place or into scratch at
+ * the same offset as in the line. Dropping at least one quote always leaves
+ * room for the NUL.
+ */
+bool token_add_quoted(TokenList *list, const char *start, const char *end) {
+    bool more = token_add(list, start, end);
+
+    Span *token = &list->tokens[list->count - 1];
+    start = token->str;
+    end = token->str + token->len;
+
+    if (token->len >= 2 && start[0] == '"' && end[-1] == '"' && memchr(start + 1, '"', token->len - 2) == NULL) {
+        *token = (Span) { .str = start + 1, .len = token->len - 2 };
+        return more;
+    }
+
+    char *dest = list->scratch ? list->scratch + (start - list->line) : (char *) start;
+    char *out = dest;
+    bool quoted = false;
+    for (const char *pos = start; pos < end; pos++) {
+        if (*pos != '"') {
+            *out++ = *pos;
+        }
+        else if (quoted && pos + 1 < end && pos[1] == '"') {
+            *out++ = '"';
+            pos++;
+        }
+        else {
+            quoted = !quoted;
+        }
+    }
+    *out = '\0';
+
+    *token = (Span) { .str = dest, .len = out - dest };
+    return more;
+}
+
+/**
+ * Splits the rest of a row that holds quotes, from field on. Delimiters and
+ * newlines only count outside quotes, and "" is an escaped quote.
+ */
+void token_split_quoted(TokenList *list, const char *field, const char *end, const char *delimiter, size_t delimiter_len) {
+    const char *pos = field;
+    bool quoted = false;
+    bool has_quotes = false;
+
+    while (true) {
+        if (pos < end) {
+            char c = *pos;
+            if (c == '"') {
+                quoted = !quoted;
+                has_quotes = true;
+                pos++;
+                continue;
+            }
+
+            bool is_delimiter = c == delimiter[0] && (delimiter_len == 1 ||
+                ((size_t) (end - pos) >= delimiter_len && memcmp(pos, delimiter, delimiter_len) == 0));
+            if (quoted || (c != '\n' && !is_delimiter)) {
+                pos++;
+                continue;
+            }
+        }
+
+        bool more = has_quotes ? token_add_quoted(list, field, pos) : token_add(list, field, pos);
+        if (!more || pos >= end || *pos == '\n') {
+            return;
+        }
+
+        pos += delimiter_len;
+        field = pos;
+        has_quotes = false;
+    }
+}
+
+/**
+ * Scans the bytes from pos to end one by one, adding the fields it passes.
+ */
+TokenScan token_scan_scalar(TokenList *list, const char **field, const char *pos, const char *end, char delimiter) {
+    for (; pos < end; pos++) {
+        if (*pos == '"') {
+            return TOKEN_QUOTE;
+        }
+
+        if (*pos == delimiter || *pos == '\n') {
+            bool more = token_add(list, *field, pos);
+            *field = pos + 1;
+
+            if (!more || *pos == '\n') {
+                return TOKEN_DONE;
+            }
+        }
+    }
+
+    return TOKEN_MORE;
+}
+
+/**
+ * Ends a row after the block scan stopped, at a quote or the end of the line.
+ */
+int token_finish(TokenList *list, TokenScan scan, const char *field, const char *end, char delimiter) {
+    if (scan == TOKEN_QUOTE) {
+        token_split_quoted(list, field, end, &delimiter, 1);
+    }
+    else if (scan == TOKEN_MORE) {
+        token_add(list, field, end);
+    }
+
+    return list->count;
+}
+
+int token_split_scalar(TokenList *list, Span line, char delimiter) {
+    const char *field = line.str;
+    const char *end = line.str + line.len;
+
+    TokenScan scan = token_scan_scalar(list, &field, line.str, end, delimiter);
+    return token_finish(list, scan, field, end, delimiter);
+}
+
+#ifdef TOKEN_X86
+
+/**
+ * Turns a bitmask of delimiter, newline and quote hits at pos into fields.
+ * Stops at the first quote, leaving field at the start of the quoted field.
+ */
+TokenScan token_scan_mask(TokenList *list, const char **field, const char *pos, unsigned int mask) {
+    while (mask) {
+        const char *hit = pos + __builtin_ctz(mask);
+        if (*hit == '"') {
+            return TOKEN_QUOTE;
+        }
+
+        bool more = token_add(list, *field, hit);
+        *field = hit + 1;
+
+        if (!more || *hit == '\n') {
+            return TOKEN_DONE;
+        }
+        mask &= mask - 1;
+    }
+
+    return TOKEN_MORE;
+}
+
+unsigned int token_mask_sse2(const char *pos, char delimiter) {
+    __m128i block = _mm_loadu_si128((const __m128i *) pos);
+    return _mm_movemask_epi8(_mm_or_si128(
+        _mm_or_si128(
+            _mm_cmpeq_epi8(block, _mm_set1_epi8(delimiter)),
+            _mm_cmpeq_epi8(block, _mm_set1_epi8('\n'))
+        ),
+        _mm_cmpeq_epi8(block, _mm_set1_epi8('"'))
+    ));
+}
+
+int token_split_sse2(TokenList *list, Span line, char delimiter) {
+    const char *field = line.str;
+    const char *pos = line.str;
+    const char *end = line.str + line.len;
+    TokenScan scan = TOKEN_MORE;
+
+    for (; pos + 16 <= end && scan == TOKEN_MORE; pos += 16) {
+        scan = token_scan_mask(list, &field, pos, token_mask_sse2(pos, delimiter));
+    }
+
+    if (scan == TOKEN_MORE) {
+        scan = token_scan_scalar(list, &field, pos, end, delimiter);
+    }
+    return token_finish(list, scan, field, end, delimiter);
+}
+
+__attribute__((target("avx2")))
+int token_split_avx2(TokenList *list, Span line, char delimiter) {
+    const char *field = line.str;
+    const char *pos = line.str;
+    const char *end = line.str + line.len;
+    TokenScan scan = TOKEN_MORE;
+
+    const __m256i delimiters = _mm256_set1_epi8(delimiter);
+    const __m256i newlines = _mm256_set1_epi8('\n');
+    const __m256i quotes = _mm256_set1_epi8('"');
+
+    for (; pos + 32 <= end && scan == TOKEN_MORE; pos += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i *) pos);
+        unsigned int mask = (unsigned int) _mm256_movemask_epi8(_mm256_or_si256(
+            _mm256_or_si256(
+                _mm256_cmpeq_epi8(block, delimiters),
+                _mm256_cmpeq_epi8(block, newlines)
+            ),
+            _mm256_cmpeq_epi8(block, quotes)
+        ));
+
+        scan = token_scan_mask(list, &field, pos, mask);
+    }
+
+    // Rows are short, so the last 16 bytes are worth a block of their own
+    if (scan == TOKEN_MORE && pos + 16 <= end) {
+        scan = token_scan_mask(list, &field, pos, token_mask_sse2(pos, delimiter));
+        pos += 16;
+    }
+
+    if (scan == TOKEN_MORE) {
+        scan = token_scan_scalar(list, &field, pos, end, delimiter);
+    }
+    return token_finish(list, scan, field, end, delimiter);
+}
+
+TokenSplit token_split_char = token_split_sse2;
+
+#else
+
+TokenSplit token_split_char = token_split_scalar;
+
+#endif
+
+/**
+ * Picks the widest scanner the CPU supports. Until called, the SSE2 scanner,
+ * which every x86-64 CPU has, is used.
+ */
+void token_init(void) {
+#ifdef TOKEN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        token_split_char = token_split_avx2;
+    }
+#endif
+}
+
+/**
+ * Multi character delimiters are searched for with memmem. No SIMD here, as
+ * they are rare.
+ */
+int token_split_str(TokenList *list, Span line, const char *delimiter) {
+    size_t delimiter_len = strlen(delimiter);
+    const char *field = line.str;
+    const char *end = line.str + line.len;
+
+    if (memchr(field, '"', line.len) != NULL) {
+        token_split_quoted(list, field, end, delimiter, delimiter_len);
+        return list->count;
+    }
+
+    const char *newline = memchr(field, '\n', line.len);
+    if (newline) {
+        end = newline;
+    }
+
+    const char *hit;
+    while ((hit = memmem(field, end - field, delimiter, delimiter_len)) != NULL) {
+        if (!token_add(list, field, hit)) {
+            return list->count;
+        }
+        field = hit + delimiter_len;
+    }
+    token_add(list, field, end);
+
+    return list->count;
+}
+
+/**
+ * Splits line into fields at delimiter, stopping at the first newline outside
+ * quotes or after limit fields, and trims white space around every field.
+ * Quoted fields lose their quotes, and escaped quotes are unescaped into
+ * scratch, which must hold line.len + 1 bytes, or in place in line when
+ * scratch is NULL. The fields point into line or scratch, and the list is
+ * ended by a NULL field. Returns the number of fields.
+ */
+int token_split(Span *tokens, int max_tokens, int limit, Span line, const char *delimiter, char *scratch) {
+    TokenList list = {
+        .tokens = tokens,
+        .count = 0,
+        .max_tokens = max_tokens,
+        .limit = limit,
+        .line = line.str,
+        .scratch = scratch
+    };
+
+    if (limit <= 0) {
+        tokens[0].str = NULL;
+        return 0;
+    }
+
+    if (delimiter[0] != '\0' && delimiter[1] == '\0') {
+        token_split_char(&list, line, delimiter[0]);
+    }
+    else if (delimiter[0] != '\0') {
+        token_split_str(&list, line, delimiter);
+    }
+    else {
+        token_add(&list, line.str, line.str + line.len);
+    }
+
+    tokens[list.count].str = NULL;
+    return list.count;
+}
@@ -0,0 +1,174 @@
+/**
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 43):
+ *
+ * GitHub Co-pilot and <jens@bennerhq.com> wrote this file.  As long as you
+ * retain this notice you can do whatever you want with this stuff. If we meet
+ * some day, and you think this stuff is worth it, you can buy me a beer in
+ * return.
+ *
+ * /benner
+ * ----------------------------------------------------------------------------
+ */
+
+/**
+ * writer.c - Output file writer, optionally flushing on its own thread
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "../hdr/dmalloc.h"
+#include "../hdr/writer.h"
+#include "../hdr/queue.h"
+
+struct WriteBehind {
+    FILE *file;
+    Buffer *blocks;
+    int block_count;
+    Queue full;
+    Queue empty;
+    pthread_t thread;
+};
+
+void *write_behind_thread(void *arg) {
+    WriteBehind *behind = (WriteBehind *) arg;
+
+    Buffer *block;
+    while ((block = (Buffer *) queue_pop(&behind->full)) != NULL) {
+        if (fwrite(block->data, sizeof(char), block->len, behind->file) != block->len) {
+            fprintf(stderr, "Error writing output\n");
+            exit(EXIT_FAILURE);
+        }
+
+        block->len = 0;
+        queue_push(&behind->empty, block);
+    }
+
+    return NULL;
+}
+
+/**
+ * Starts a thread that owns the output file. Full output buffers are handed
+ * over through a queue and come back empty, so at most block_count buffers
+ * are ever in flight.
+ */
+void write_behind_start(Writer *writer, int block_count) {
+    WriteBehind *behind = (WriteBehind *) mem_malloc(sizeof(WriteBehind));
+    if (behind == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    behind->file = writer->file;
+    behind->block_count = block_count < 2 ? 2 : block_count;
+    behind->blocks = (Buffer *) mem_malloc(behind->block_count * sizeof(Buffer));
+    if (behind->blocks == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // One extra slot for the NULL that stops the thread
+    queue_init(&behind->full, behind->block_count + 1);
+    queue_init(&behind->empty, behind->block_count);
+    for (int index = 0; index < behind->block_count; index++) {
+        behind->blocks[index] = (Buffer) { .data = NULL, .len = 0, .size = 0 };
+        queue_push(&behind->empty, &behind->blocks[index]);
+    }
+
+    if (pthread_create(&behind->thread, NULL, write_behind_thread, behind) != 0) {
+        fprintf(stderr, "Error: Can't start writer thread\n");
+        exit(EXIT_FAILURE);
+    }
+
+    writer->behind = behind;
+}
+
+void write_behind_stop(WriteBehind *behind) {
+    queue_push(&behind->full, NULL);
+    pthread_join(behind->thread, NULL);
+
+    for (int index = 0; index < behind->block_count; index++) {
+        buffer_free(&behind->blocks[index]);
+    }
+    queue_free(&behind->full);
+    queue_free(&behind->empty);
+    mem_free(behind->blocks);
+    mem_free(behind);
+}
+
+/**
+ * Opens filename for writing, "-" being stdout. With write_behind > 0 the
+ * actual writes are done by a writer thread with that many buffers in flight.
+ * With gzip_threads > 0 the output is gzip compressed on that many threads,
+ * which brings its own writer thread.
+ */
+bool writer_open(Writer *writer, const char *filename, int write_behind, int gzip_threads) {
+    writer->behind = NULL;
+    writer->gzip = NULL;
+    writer->file = strcmp(filename, "-") == 0 ? stdout : fopen(filename, "wb");
+    if (writer->file == NULL) {
+        return false;
+    }
+
+    if (gzip_threads > 0) {
+        writer->gzip = gzip_writer_open(writer->file, gzip_threads);
+    }
+    else if (write_behind > 0) {
+        write_behind_start(writer, write_behind);
+    }
+
+    return true;
+}
+
+/**
+ * Writes and empties output. On the writer thread the buffer is swapped for
+ * an empty one instead, so the caller carries on without copying.
+ */
+void writer_write(Writer *writer, Buffer *output) {
+    if (output->len == 0) {
+        return;
+    }
+
+    if (writer->gzip) {
+        gzip_writer_write(writer->gzip, output);
+        return;
+    }
+
+    if (writer->behind == NULL) {
+        if (fwrite(output->data, sizeof(char), output->len, writer->file) != output->len) {
+            fprintf(stderr, "Error writing output\n");
+            exit(EXIT_FAILURE);
+        }
+        output->len = 0;
+        return;
+    }
+
+    Buffer *block = (Buffer *) queue_pop(&writer->behind->empty);
+    Buffer swap = *block;
+    *block = *output;
+    *output = swap;
+
+    queue_push(&writer->behind->full, block);
+}
+
+void writer_close(Writer *writer) {
+    if (writer->gzip) {
+        gzip_writer_close(writer->gzip);
+        writer->gzip = NULL;
+    }
+
+    if (writer->behind) {
+        write_behind_stop(writer->behind);
+        writer->behind = NULL;
+    }
+
+    if (writer->file == stdout) {
+        fflush(writer->file);
+    }
+    else {
+        fclose(writer->file);
+    }
+    writer->file = NULL;
+}